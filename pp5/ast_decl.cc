@@ -31,7 +31,7 @@ void VarDecl::Check() {
 }
 
 void VarDecl::Emit(CodeGenerator *cg) {
-    SetVar(cg->GenVar(id->GetName()));
+    SetVar(cg->GenVar(id->GetName(), type->GetPointerKind()));
 }
   
 
@@ -85,7 +85,10 @@ void ClassDecl::Emit(CodeGenerator *cg) {
         labels->Append(strdup(tmp));
     }
 
-    cg->GenVTable(id->GetName(), labels);
+    List<int> *pointers = new List<int>;
+    PointerFields(pointers);
+
+    cg->GenVTable(id->GetName(), labels, pointers);
 }
 
 // This is not done very cleanly. I should sit down and sort this out. Right now
@@ -231,6 +234,60 @@ int ClassDecl::VarDeclOffset(VarDecl *find) {
     return -1;
 }
 
+void ClassDecl::PointerFields(List<int> *offsets) {
+    if (extends) {
+        ClassDecl *ext = dynamic_cast<ClassDecl*>(parent->FindDecl(extends->GetId()));
+        if (ext)
+            ext->PointerFields(offsets);
+    }
+
+    for (int i = 0; i < members->NumElements(); i++) {
+        VarDecl *vd = dynamic_cast<VarDecl *>(members->Nth(i));
+        if (!vd || vd->GetDeclaredType()->GetPointerKind() == notPointer)
+            continue;
+
+        int off = VarDeclOffset(vd) * CodeGenerator::VarSize;
+        offsets->Append(off + vd->GetDeclaredType()->GetPointerKind());
+    }
+}
+
+List<ClassDecl *> *ClassDecl::instantiated = new List<ClassDecl *>;
+
+void ClassDecl::Instantiate() {
+    for (int i = 0; i < instantiated->NumElements(); i++) {
+        if (instantiated->Nth(i) == this)
+            return;
+    }
+    instantiated->Append(this);
+}
+
+/* Class hierarchy analysis: every instantiated class that is this one
+ * or extends it has fd's slot in its vtable, and the call goes to
+ * whichever method fills it. One method for all of them makes the call
+ * monomorphic. */
+FnDecl *ClassDecl::Resolve(FnDecl *fd) {
+    FnDecl *target = NULL;
+    int off = fd->GetOff();
+
+    for (int i = 0; i < instantiated->NumElements(); i++) {
+        ClassDecl *cd = instantiated->Nth(i);
+        if (cd != this && !cd->DoExtend(this))
+            continue;
+
+        if (off >= cd->methods->NumElements())
+            return NULL;
+
+        FnDecl *impl = cd->methods->Nth(off);
+        if (!dynamic_cast<ClassDecl *>(impl->GetParent()))
+            return NULL;
+        if (target && target != impl)
+            return NULL;
+        target = impl;
+    }
+
+    return target;
+}
+
 
 InterfaceDecl::InterfaceDecl(Identifier *n, List<FnDecl*> *m) : Decl(n) {
     Assert(n != NULL && m != NULL);
@@ -317,12 +374,13 @@ void FnDecl::Emit(CodeGenerator *cg) {
         cg->GenLabel(tmp);
     }
 
-    cg->GenBeginFunc();
+    cg->GenBeginFunc()->SetNumParams(haveThis + formals->NumElements());
 
     for (int i = 0; i < formals->NumElements(); i++) {
         VarDecl *decl = formals->Nth(i);
 
         decl->SetVar(new Location(fpRelative, cg->OffsetToFirstParam + (haveThis + i) * cg->VarSize, decl->GetId()->GetName()));
+        decl->GetVar()->SetPointer(decl->GetDeclaredType()->GetPointerKind());
     }
 
     if (body)
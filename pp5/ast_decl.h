@@ -78,6 +78,19 @@ class ClassDecl : public Decl
 
     unsigned int NumFields() { return fields; }
     int VarDeclOffset(VarDecl *find);
+
+    /* The fields the garbage collector follows, inherited ones too,
+     * each as its byte offset plus its PointerKind */
+    void PointerFields(List<int> *offsets);
+
+    /* Rapid type analysis: the classes some NewExpr creates. Only
+     * their vtables can be behind a call. */
+    static List<ClassDecl *> *instantiated;
+    void Instantiate();
+
+    /* The only method a call to fd on an object of this static class
+     * can reach, or NULL if that is not known */
+    FnDecl *Resolve(FnDecl *fd);
 };
 
 class InterfaceDecl : public Decl 
@@ -9,6 +9,23 @@
 #include <string.h>
 
 
+/* The collector finds objects and arrays through the locations that
+ * hold them, see stackmap.h */
+void Expr::SetVar(Location *l) {
+    dst = l;
+    if (l && type && l->GetPointer() == notPointer)
+        l->SetPointer(type->GetPointerKind());
+}
+
+void Expr::EmitBranch(CodeGenerator *cg, bool jumpIf, const char *label) {
+    Emit(cg);
+    if (jumpIf)
+        cg->GenIfCompare("!=", GetVar(), cg->GenLoadConstant(0), label);
+    else
+        cg->GenIfZ(GetVar(), label);
+}
+
+
 void EmptyExpr::Check() {
     SetType(Type::voidType);
 }
@@ -37,6 +54,11 @@ void BoolConstant::Emit(CodeGenerator *cg) {
     SetVar(cg->GenLoadConstant((value)?1:0));
 }
 
+void BoolConstant::EmitBranch(CodeGenerator *cg, bool jumpIf, const char *label) {
+    if (value == jumpIf)
+        cg->GenGoto(label);
+}
+
 StringConstant::StringConstant(yyltype loc, const char *val) : Expr(loc) {
     Assert(val != NULL);
     value = strdup(val);
@@ -77,25 +99,49 @@ CompoundExpr::CompoundExpr(Operator *o, Expr *r)
     (right=r)->SetParent(this);
 }
 
+/* A string constant is passed second to _StringEqualLiteral, which
+ * finds its length in the word before it (see Mips::EmitStringPool). */
+static Location *EmitStringEqual(CodeGenerator *cg, Expr *left, Expr *right) {
+    if (dynamic_cast<StringConstant*>(left)) {
+        Expr *constant = left;
+        left = right;
+        right = constant;
+    }
+    BuiltIn fn = dynamic_cast<StringConstant*>(right) ? StringEqualLiteral : StringEqual;
+    return cg->GenBuiltInCall(fn, left->GetVar(), right->GetVar());
+}
+
+/* && and || only evaluate their right side if the left one doesn't
+ * decide the result, so their value is computed with branches */
 void CompoundExpr::Emit(CodeGenerator *cg) {
+    char *token = op->GetToken();
+    if (!strcmp(token, "&&") || !strcmp(token, "||")) {
+        bool isOr = !strcmp(token, "||");
+        const char *done = cg->NewLabel();
+        Location *result = cg->GenTempVar();
+        cg->GenAssign(result, cg->GenLoadConstant(isOr ? 1 : 0));
+        EmitBranch(cg, isOr, done);
+        cg->GenAssign(result, cg->GenLoadConstant(isOr ? 0 : 1));
+        cg->GenLabel(done);
+        SetVar(result);
+        return;
+    }
+
     if (left)
         left->Emit(cg);
     right->Emit(cg);
 
-    char *token = op->GetToken();
     if (!strcmp(token, "==") && left->GetType() == Type::stringType) {
-        SetVar(cg->GenBuiltInCall(StringEqual, left->GetVar(), right->GetVar()));
+        SetVar(EmitStringEqual(cg, left, right));
     } else if (!strcmp(token, "!=") && left->GetType() == Type::stringType) {
-        Location *eq = cg->GenBuiltInCall(StringEqual, left->GetVar(), right->GetVar());
+        Location *eq = EmitStringEqual(cg, left, right);
         SetVar(cg->GenBinaryOp("==", eq, cg->GenLoadConstant(0)));
     } else if (!strcmp(token, "<=")) {
-        Location *lt = cg->GenBinaryOp("<", left->GetVar(), right->GetVar());
-        Location *eq = cg->GenBinaryOp("==", left->GetVar(), right->GetVar());
-        SetVar(cg->GenBinaryOp("||", lt, eq));
-    } else if (!strcmp(token, ">=")) {
         Location *gt = cg->GenBinaryOp("<", right->GetVar(), left->GetVar());
-        Location *eq = cg->GenBinaryOp("==", right->GetVar(), left->GetVar());
-        SetVar(cg->GenBinaryOp("||", gt, eq));
+        SetVar(cg->GenBinaryOp("==", gt, cg->GenLoadConstant(0)));
+    } else if (!strcmp(token, ">=")) {
+        Location *lt = cg->GenBinaryOp("<", left->GetVar(), right->GetVar());
+        SetVar(cg->GenBinaryOp("==", lt, cg->GenLoadConstant(0)));
     } else if (!strcmp(token, ">")) {
         SetVar(cg->GenBinaryOp("<", right->GetVar(), left->GetVar()));
     } else if (!strcmp(token, "!=")) {
@@ -110,6 +156,45 @@ void CompoundExpr::Emit(CodeGenerator *cg) {
     }
 }
 
+static bool IsComparison(const char *token) {
+    return !strcmp(token, "<") || !strcmp(token, "<=") || !strcmp(token, ">")
+        || !strcmp(token, ">=") || !strcmp(token, "==") || !strcmp(token, "!=");
+}
+
+/* Comparisons of ints, bools and objects become a single compare and
+ * branch (strings are compared by calling _StringEqual, which leaves
+ * a value to test). && and || short-circuit into control flow. */
+void CompoundExpr::EmitBranch(CodeGenerator *cg, bool jumpIf, const char *label) {
+    char *token = op->GetToken();
+
+    if (!strcmp(token, "!")) {
+        right->EmitBranch(cg, !jumpIf, label);
+        return;
+    } else if (!strcmp(token, "&&") || !strcmp(token, "||")) {
+        bool isOr = !strcmp(token, "||");
+        if (jumpIf == isOr) {
+            left->EmitBranch(cg, jumpIf, label);
+            right->EmitBranch(cg, jumpIf, label);
+        } else {
+            const char *skip = cg->NewLabel();
+            left->EmitBranch(cg, !jumpIf, skip);
+            right->EmitBranch(cg, jumpIf, label);
+            cg->GenLabel(skip);
+        }
+        return;
+    }
+
+    if (left && IsComparison(token) && left->GetType() != Type::stringType) {
+        left->Emit(cg);
+        right->Emit(cg);
+        IfCompare::Relation r = IfCompare::RelationForName(token);
+        if (!jumpIf) r = IfCompare::Negate(r);
+        cg->GenIfCompare(IfCompare::relationName[r], left->GetVar(), right->GetVar(), label);
+        return;
+    }
+    Expr::EmitBranch(cg, jumpIf, label);
+}
+
 
 void ArithmeticExpr::Check() {
     if (left) {
@@ -297,15 +382,13 @@ void ArrayAccess::Emit(CodeGenerator *cg) {
     /* Error checking */
     {
         char *skip = cg->NewLabel();
-        Location *zero = cg->GenLoadConstant(0);
-        Location *negative = cg->GenBinaryOp("<", subscript->GetVar(), zero);
-        Location *size = cg->GenLoad(base->GetVar(), -cg->VarSize);
-        Location *lt = cg->GenBinaryOp("<", subscript->GetVar(), size);
-        Location *gteq = cg->GenBinaryOp("==", lt, zero);
-        Location *cmp = cg->GenBinaryOp("||", negative, gteq);
-        cg->GenIfZ(cmp, skip);
+        char *error = cg->NewLabel();
+        cg->GenIfCompare("<", subscript->GetVar(), cg->GenLoadConstant(0), error);
+        Location *size = cg->GenLoad(base->GetVar(), -cg->VarSize, true);
+        cg->GenIfCompare("<", subscript->GetVar(), size, skip);
 
         /* Error occured */
+        cg->GenLabel(error);
         Location *str = cg->GenLoadConstant("Decaf runtime error: Array subscript out of bounds\\n");
         cg->GenBuiltInCall(PrintString, str);
         cg->GenBuiltInCall(Halt);
@@ -315,6 +398,7 @@ void ArrayAccess::Emit(CodeGenerator *cg) {
 
     Location *rel = cg->GenBinaryOp("*", cg->GenLoadConstant(4), subscript->GetVar());
     Location *abs = cg->GenBinaryOp("+", base->GetVar(), rel);
+    abs->SetPointer(interiorPointer);
 
     SetVar(cg->GenLoad(abs));
 }
@@ -326,15 +410,13 @@ void ArrayAccess::EmitStore(CodeGenerator *cg, Expr *src) {
     /* Error checking */
     {
         char *skip = cg->NewLabel();
-        Location *zero = cg->GenLoadConstant(0);
-        Location *negative = cg->GenBinaryOp("<", subscript->GetVar(), zero);
-        Location *size = cg->GenLoad(base->GetVar(), -cg->VarSize);
-        Location *lt = cg->GenBinaryOp("<", subscript->GetVar(), size);
-        Location *gteq = cg->GenBinaryOp("==", lt, zero);
-        Location *cmp = cg->GenBinaryOp("||", negative, gteq);
-        cg->GenIfZ(cmp, skip);
+        char *error = cg->NewLabel();
+        cg->GenIfCompare("<", subscript->GetVar(), cg->GenLoadConstant(0), error);
+        Location *size = cg->GenLoad(base->GetVar(), -cg->VarSize, true);
+        cg->GenIfCompare("<", subscript->GetVar(), size, skip);
 
         /* Error occured */
+        cg->GenLabel(error);
         Location *str = cg->GenLoadConstant("Decaf runtime error: Array subscript out of bounds\\n");
         cg->GenBuiltInCall(PrintString, str);
         cg->GenBuiltInCall(Halt);
@@ -344,6 +426,7 @@ void ArrayAccess::EmitStore(CodeGenerator *cg, Expr *src) {
 
     Location *rel = cg->GenBinaryOp("*", cg->GenLoadConstant(4), subscript->GetVar());
     Location *abs = cg->GenBinaryOp("+", base->GetVar(), rel);
+    abs->SetPointer(interiorPointer);
 
     /* The solution seems to do this after all of the arithmetic, so I'll follow it */
     src->Emit(cg);
@@ -551,7 +634,7 @@ void Call::Emit(CodeGenerator *cg) {
     if (!fd) {
         /* Array.length() */
         base->Emit(cg);
-        SetVar(cg->GenLoad(base->GetVar(), -cg->VarSize));
+        SetVar(cg->GenLoad(base->GetVar(), -cg->VarSize, true));
     } else {
         Location *fnptr = 0;
         Location *thiz = 0;
@@ -562,20 +645,46 @@ void Call::Emit(CodeGenerator *cg) {
             arg->Emit(cg);
         }
 
-        if (base) {
+        /* A method that no instantiated subclass overrides is called
+         * directly, which also lets the inliner copy it */
+        FnDecl *target = NULL;
+        if (GetOptimizationLevel() > 0 && (base || fd->IsMethodDecl())) {
+            ClassDecl *cd = NULL;
+            if (base) {
+                NamedType *nt = dynamic_cast<NamedType *>(base->GetType());
+                if (nt)
+                    cd = dynamic_cast<ClassDecl *>(nt->GetDeclForType());
+            } else {
+                for (Node *n = this; n && !cd; n = n->GetParent())
+                    cd = dynamic_cast<ClassDecl *>(n);
+            }
+            if (cd)
+                target = cd->Resolve(fd);
+        }
+
+        if (target) {
+            /* The vtable isn't needed, but loading it still faults on
+             * a null receiver as the virtual call would have */
+            if (base) {
+                base->Emit(cg);
+                cg->GenLoad(base->GetVar(), 0, true);
+            }
+
+            thiz = base ? base->GetVar() : cg->ThisPtr;
+        } else if (base) {
             base->Emit(cg);
 
             unsigned int loc = fd->GetOff() * cg->VarSize;
 
-            Location *vtable = cg->GenLoad(base->GetVar());
-            fnptr = cg->GenLoad(vtable, loc);
+            Location *vtable = cg->GenLoad(base->GetVar(), 0, true);
+            fnptr = cg->GenLoad(vtable, loc, true);
 
             thiz = base->GetVar();
         } else if (fd->IsMethodDecl()) {
             unsigned int loc = fd->GetOff() * cg->VarSize;
 
-            Location *vtable = cg->GenLoad(cg->ThisPtr);
-            fnptr = cg->GenLoad(vtable, loc);
+            Location *vtable = cg->GenLoad(cg->ThisPtr, 0, true);
+            fnptr = cg->GenLoad(vtable, loc, true);
 
             thiz = cg->ThisPtr;
         }
@@ -586,7 +695,19 @@ void Call::Emit(CodeGenerator *cg) {
             cg->GenPushParam(arg->GetVar());
         }
 
-        if (fnptr) {
+        if (target) {
+            char tmp[128];
+            ClassDecl *owner = dynamic_cast<ClassDecl *>(target->GetParent());
+            sprintf(tmp, "_%s.%s", owner->GetName(), target->GetName());
+            PrintDebug("devirt", "line %d: %s called directly", location->first_line, tmp);
+
+            cg->GenPushParam(thiz);
+
+            Location *out = cg->GenLCall(tmp, fd->GetReturnType() != Type::voidType);
+            cg->GenPopParams(cg->VarSize * actuals->NumElements() + cg->VarSize);
+
+            SetVar(out);
+        } else if (fnptr) {
             cg->GenPushParam(thiz);
 
             Location *out = cg->GenACall(fnptr, fd->GetReturnType() != Type::voidType);
@@ -618,6 +739,7 @@ void NewExpr::Check() {
         ReportError::IdentifierNotDeclared(cType->GetId(), LookingForClass);
         SetType(Type::errorType);
     } else {
+        cd->Instantiate();
         SetType(cType);
     }
 }
@@ -628,7 +750,7 @@ void NewExpr::Emit(CodeGenerator *cg) {
     unsigned int size = (cd->NumFields() + 1) * cg->VarSize;
 
     Location *cnt = cg->GenLoadConstant(size);
-    Location *addr = cg->GenBuiltInCall(Alloc, cnt);
+    Location *addr = cg->GenAlloc(cnt, CodeGenerator::ObjectHeader);
     cg->GenStore(addr, cg->GenLoadLabel(cd->GetId()->GetName()));
 
     SetVar(addr);
@@ -660,8 +782,7 @@ void NewArrayExpr::Emit(CodeGenerator *cg) {
     /* The provided solution does bounds checking, so included here for easy diffing */
     {
         char *skip = cg->NewLabel();
-        Location *cmp = cg->GenBinaryOp("<", size->GetVar(), cg->GenLoadConstant(0));
-        cg->GenIfZ(cmp, skip);
+        cg->GenIfCompare(">=", size->GetVar(), cg->GenLoadConstant(0), skip);
 
         /* Error occured */
         Location *str = cg->GenLoadConstant("Decaf runtime error: Array size is <= 0\\n");
@@ -675,7 +796,7 @@ void NewArrayExpr::Emit(CodeGenerator *cg) {
     Location *four = cg->GenLoadConstant(cg->VarSize);
     Location *bytes = cg->GenBinaryOp("*", cnt, four);
 
-    Location *arr = cg->GenBuiltInCall(Alloc, bytes);
+    Location *arr = cg->GenAlloc(bytes, elemType->GetPointerKind());
 
     /* Store size */
     cg->GenStore(arr, size->GetVar());
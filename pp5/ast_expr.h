@@ -31,13 +31,19 @@ class Expr : public Stmt
     Instruction *instr;
 
   public:
-    Expr(yyltype loc) : Stmt(loc) {}
-    Expr() : Stmt() {}
+    Expr(yyltype loc) : Stmt(loc), type(NULL) {}
+    Expr() : Stmt(), type(NULL) {}
 
     Type *GetType() { return type; }
     void SetType(Type *t) { type = t; }
     Location *GetVar() { return dst; }
-    void SetVar(Location *l) { dst = l; }
+    // Also marks l as a pointer if the expression is an object or array
+    void SetVar(Location *l);
+
+    // Emits a bool expression used as a condition: jumps to label if
+    // its value is jumpIf and falls through otherwise. Comparisons and
+    // the logical operators branch directly instead of computing 0/1.
+    virtual void EmitBranch(CodeGenerator *cg, bool jumpIf, const char *label);
 };
 
 /* This node type is used for those places where an expression is optional.
@@ -78,6 +84,7 @@ class BoolConstant : public Expr
     BoolConstant(yyltype loc, bool val);
 
     void Emit(CodeGenerator *cg);
+    void EmitBranch(CodeGenerator *cg, bool jumpIf, const char *label);
 };
 
 class StringConstant : public Expr 
@@ -122,6 +129,7 @@ class CompoundExpr : public Expr
     CompoundExpr(Operator *op, Expr *rhs);             // for unary
 
     virtual void Emit(CodeGenerator *cg);
+    void EmitBranch(CodeGenerator *cg, bool jumpIf, const char *label);
 };
 
 class ArithmeticExpr : public CompoundExpr 
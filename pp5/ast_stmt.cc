@@ -121,8 +121,7 @@ void WhileStmt::Emit(CodeGenerator *cg) {
 
     cg->GenLabel(cont);
     /* while (test) */
-    test->Emit(cg);
-    cg->GenIfZ(test->GetVar(), stop);
+    test->EmitBranch(cg, false, stop);
     /* while (...) body */
     body->Emit(cg);
     cg->GenGoto(cont);
@@ -149,8 +148,7 @@ void ForStmt::Emit(CodeGenerator *cg) {
     init->Emit(cg);
     cg->GenLabel(cont);
     /* for(...;test;...) */
-    test->Emit(cg);
-    cg->GenIfZ(test->GetVar(), stop);
+    test->EmitBranch(cg, false, stop);
     /* for(...;...;...) body */
     body->Emit(cg);
     /* for(...;...;step) */
@@ -172,10 +170,8 @@ void IfStmt::Check() {
 }
 
 void IfStmt::Emit(CodeGenerator *cg) {
-    test->Emit(cg);
-
     const char *skip = cg->NewLabel();
-    cg->GenIfZ(test->GetVar(), skip);
+    test->EmitBranch(cg, false, skip);
 
     body->Emit(cg);
     if (elseBody) {
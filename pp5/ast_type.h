@@ -14,6 +14,7 @@
 
 #include "ast.h"
 #include "list.h"
+#include "tac.h" // for PointerKind
 #include <iostream>
 
 
@@ -33,6 +34,9 @@ class Type : public Node
     friend std::ostream& operator<<(std::ostream& out, Type *t) { t->PrintToStream(out); return out; }
     virtual bool IsEquivalentTo(Type *other) { return this == other; }
     virtual bool IsCompatibleTo(Type *other) { return this == Type::errorType || other == Type::errorType || IsEquivalentTo(other); }
+
+    // Objects and arrays live on the collected heap; strings don't
+    virtual PointerKind GetPointerKind() { return notPointer; }
 };
 
 class NamedType : public Type 
@@ -53,6 +57,7 @@ class NamedType : public Type
     Identifier *GetId() { return id; }
     bool IsEquivalentTo(Type *other);
     bool IsCompatibleTo(Type *other);
+    PointerKind GetPointerKind() { return objectPointer; }
 };
 
 class ArrayType : public Type 
@@ -68,6 +73,7 @@ class ArrayType : public Type
     bool IsEquivalentTo(Type *other);
 
     Type *GetElemType() { return elemType; }
+    PointerKind GetPointerKind() { return arrayPointer; }
 };
 
  
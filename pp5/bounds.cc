@@ -0,0 +1,129 @@
+/* File: bounds.cc
+ * ---------------
+ * Implementation of bounds check elimination.
+ */
+
+#include "bounds.h"
+#include "cfg.h"
+#include "codegen.h"
+#include <string.h>
+
+
+bool BoundsCheckElimination::IsConstant(Location *loc, int value)
+{
+  LoadConstant *def = defs.count(loc) ? dynamic_cast<LoadConstant*>(defs[loc]) : NULL;
+  return def && def->GetValue() == value;
+}
+
+/* Method: FindNonNegative
+ * -----------------------
+ * Starts from every value that could be non-negative and drops the
+ * ones with an operand that isn't, until nothing changes.
+ */
+void BoundsCheckElimination::FindNonNegative()
+{
+  std::map<Location*, Instruction*>::iterator p;
+  for (p = defs.begin(); p != defs.end(); ++p) {
+    Instruction *instr = p->second;
+    BinaryOp *op = dynamic_cast<BinaryOp*>(instr);
+    Load *load = dynamic_cast<Load*>(instr);
+    LoadConstant *constant = dynamic_cast<LoadConstant*>(instr);
+    if ((constant && constant->GetValue() >= 0)
+        || (load && load->IsInvariant() && load->GetOffset() == -CodeGenerator::VarSize)
+        || (op && (op->GetCode() == BinaryOp::Add || op->GetCode() == BinaryOp::Eq
+                   || op->GetCode() == BinaryOp::Less || op->GetCode() == BinaryOp::And
+                   || op->GetCode() == BinaryOp::Or))
+        || dynamic_cast<Phi*>(instr) || dynamic_cast<Assign*>(instr))
+      nonNegative.insert(p->first);
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (p = defs.begin(); p != defs.end(); ++p) {
+      Instruction *instr = p->second;
+      if (!nonNegative.count(p->first)) continue;
+      BinaryOp *op = dynamic_cast<BinaryOp*>(instr);
+      if (!dynamic_cast<Phi*>(instr) && !dynamic_cast<Assign*>(instr)
+          && !(op && op->GetCode() == BinaryOp::Add))
+        continue;   // comparisons, constants and lengths don't depend on operands
+      List<Location*> uses;
+      instr->GetUses(&uses);
+      for (int i = 0; i < uses.NumElements(); i++)
+        if (!nonNegative.count(uses.Nth(i))) {
+          nonNegative.erase(p->first);
+          changed = true;
+          break;
+        }
+    }
+  }
+}
+
+// Does knowing a r1 b tell that a r2 b?
+static bool Implies(IfCompare::Relation r1, IfCompare::Relation r2)
+{
+  if (r1 == r2) return true;
+  switch (r1) {
+    case IfCompare::Less:    return r2 == IfCompare::LessEq || r2 == IfCompare::NotEqual;
+    case IfCompare::Greater: return r2 == IfCompare::GreaterEq || r2 == IfCompare::NotEqual;
+    case IfCompare::Equal:   return r2 == IfCompare::LessEq || r2 == IfCompare::GreaterEq;
+    default:                 return false;
+  }
+}
+
+/* Method: KnownTrue
+ * -----------------
+ * Returns true if b can only be reached after some IfCompare went the
+ * way that shows a r c, that is b is dominated by a successor of the
+ * branch which is not reached any other way.
+ */
+bool BoundsCheckElimination::KnownTrue(IfCompare::Relation r, Location *a, Location *c,
+                                       BasicBlock *b)
+{
+  for (BasicBlock *cur = b; cur; cur = cur->idom) {
+    if (cur->preds->NumElements() != 1) continue;
+    IfCompare *branch = dynamic_cast<IfCompare*>(cur->preds->Nth(0)->GetLast());
+    if (!branch || cur->preds->Nth(0)->succs->NumElements() != 2) continue;
+    IfCompare::Relation known = branch->GetRelation();
+    if (!(cur->GetLabel() && !strcmp(cur->GetLabel(), branch->branch_label())))
+      known = IfCompare::Negate(known);
+    if (branch->GetOp1() == a && branch->GetOp2() == c && Implies(known, r))
+      return true;
+    if (branch->GetOp1() == c && branch->GetOp2() == a && Implies(IfCompare::Swap(known), r))
+      return true;
+  }
+  return false;
+}
+
+
+int BoundsCheckElimination::Run()
+{
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    std::list<Instruction*>::iterator p;
+    for (p = b->code.begin(); p != b->code.end(); ++p)
+      if ((*p)->GetDef() && (*p)->GetDef()->GetSegment() == fpRelative)
+        defs[(*p)->GetDef()] = *p;
+  }
+  FindNonNegative();
+
+  int removed = 0;
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    IfCompare *branch = dynamic_cast<IfCompare*>(b->GetLast());
+    if (!branch || !b->IsReachable()) continue;
+    IfCompare::Relation r = branch->GetRelation();
+    Location *a = branch->GetOp1(), *c = branch->GetOp2();
+    bool signTest = nonNegative.count(a) && IsConstant(c, 0);
+    if ((signTest && r == IfCompare::Less) || KnownTrue(IfCompare::Negate(r), a, c, b)) {
+      b->code.pop_back();
+      removed++;
+    } else if ((signTest && r == IfCompare::GreaterEq) || KnownTrue(r, a, c, b)) {
+      b->code.pop_back();
+      b->code.push_back(new Goto(branch->branch_label()));
+      removed++;
+    }
+  }
+  if (removed) graph->Rebuild();
+  return removed;
+}
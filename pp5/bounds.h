@@ -0,0 +1,58 @@
+/* File: bounds.h
+ * --------------
+ * Array bounds check elimination over a function in SSA form. An
+ * ArrayAccess checks its subscript with
+ *
+ *      If i < 0 Goto error ;  size = *(a + -4) ;  If i < size Goto ok ;
+ *      error: (print, _Halt) ;  ok: ...
+ *
+ * and the pass removes the branches it can prove:
+ *
+ *  - i < 0 is false if i is never negative. Constants, array lengths
+ *    and comparisons are not; neither is the sum of two values that
+ *    aren't (add traps on overflow rather than wrapping), a copy of
+ *    one, or a phi of them. The phis are assumed non-negative until
+ *    shown otherwise, so an induction variable that starts at zero and
+ *    counts up is found non-negative.
+ *
+ *  - i < size is true where a dominating IfCompare has been seen to go
+ *    the way that implies it (taking the branch means its relation
+ *    holds, falling through means the opposite one does). Value
+ *    numbering gives the length load of the check and the a.length()
+ *    of a loop test the same name, so inside the loop the upper test
+ *    of the check is known to pass.
+ *
+ * A branch never taken is deleted and one always taken becomes a
+ * Goto. The graph is rebuilt, and another round of constant
+ * propagation then drops the error blocks no longer reached.
+ */
+
+#ifndef _H_bounds
+#define _H_bounds
+
+#include <map>
+#include <set>
+#include "tac.h"
+
+class FlowGraph;
+class BasicBlock;
+
+class BoundsCheckElimination
+{
+  protected:
+    FlowGraph *graph;
+    std::map<Location*, Instruction*> defs;
+    std::set<Location*> nonNegative;
+
+    bool IsConstant(Location *loc, int value);
+    void FindNonNegative();
+    bool KnownTrue(IfCompare::Relation r, Location *a, Location *c, BasicBlock *b);
+
+  public:
+    BoundsCheckElimination(FlowGraph *graph) : graph(graph) {}
+
+         // Returns the number of branches removed or made unconditional
+    int Run();
+};
+
+#endif
@@ -0,0 +1,454 @@
+/* File: cfg.cc
+ * ------------
+ * Implementation of the BasicBlock and FlowGraph classes.
+ *
+ * Dominators are computed with the iterative algorithm of Cooper,
+ * Harvey and Kennedy ("A Simple, Fast Dominance Algorithm"), which
+ * walks the blocks in reverse postorder and intersects the dominator
+ * sets of the predecessors by climbing the partially built tree.
+ */
+
+#include "cfg.h"
+#include "codegen.h"
+#include <string.h>
+#include <stdio.h>
+#include <set>
+
+
+BasicBlock::BasicBlock(int n)
+{
+  id = n;
+  succs = new List<BasicBlock*>;
+  preds = new List<BasicBlock*>;
+  idom = NULL;
+  domChildren = new List<BasicBlock*>;
+  rpo = -1;
+  loopDepth = 0;
+}
+
+const char *BasicBlock::GetLabel()
+{
+  if (code.empty()) return NULL;
+  Label *l = dynamic_cast<Label*>(code.front());
+  return l ? l->text() : NULL;
+}
+
+Instruction *BasicBlock::GetLast()
+{
+  return code.empty() ? NULL : code.back();
+}
+
+void BasicBlock::Print()
+{
+  printf("B%d:", id);
+  if (!IsReachable()) printf(" (unreachable)");
+  printf("\tpreds:");
+  for (int i = 0; i < preds->NumElements(); i++)
+    printf(" B%d", preds->Nth(i)->id);
+  printf("\tsuccs:");
+  for (int i = 0; i < succs->NumElements(); i++)
+    printf(" B%d", succs->Nth(i)->id);
+  if (idom) printf("\tidom: B%d", idom->id);
+  if (loopDepth) printf("\tloop depth: %d", loopDepth);
+  printf("\n");
+
+  std::list<Instruction*>::iterator p;
+  for (p = code.begin(); p != code.end(); ++p)
+    (*p)->Print();
+}
+
+
+/* Helpers used when partitioning the instruction stream. A block ends
+ * after any instruction that transfers control, and a new one starts
+ * at every label.
+ */
+static bool IsHalt(Instruction *instr)
+{
+  LCall *call = dynamic_cast<LCall*>(instr);
+  return call && !strcmp(call->GetLabel(), "_Halt");
+}
+
+static bool EndsBlock(Instruction *instr)
+{
+  return instr->branch_label() || dynamic_cast<Return*>(instr) || IsHalt(instr);
+}
+
+static const char *BranchTarget(Instruction *instr)
+{
+  return instr ? instr->branch_label() : NULL;
+}
+
+static bool FallsThrough(Instruction *instr)
+{
+  return !instr || !(dynamic_cast<Goto*>(instr) || dynamic_cast<Return*>(instr)
+                     || IsHalt(instr));
+}
+
+
+FlowGraph::FlowGraph(const char *n, std::list<Instruction*> &code)
+{
+  name = n;
+  blocks = new List<BasicBlock*>;
+  rpoOrder = new List<BasicBlock*>;
+  labels = NULL;
+
+  Assert(!code.empty());
+  begin = dynamic_cast<BeginFunc*>(code.front());
+  Assert(begin != NULL);
+  code.pop_front();
+
+  BasicBlock *cur = NewBlock();
+  while (true) {
+    Assert(!code.empty()); // every BeginFunc has a matching EndFunc
+    Instruction *instr = code.front();
+    code.pop_front();
+
+    if (dynamic_cast<EndFunc*>(instr)) {
+      exit = NewBlock();
+      exit->code.push_back(instr);
+      break;
+    }
+    if (dynamic_cast<Label*>(instr) && !cur->code.empty())
+      cur = NewBlock();
+    cur->code.push_back(instr);
+    if (EndsBlock(instr))
+      cur = NewBlock();
+  }
+
+  // drop the empty blocks left behind by a branch right before a label
+  for (int i = 0; i < blocks->NumElements() - 1; i++) {
+    if (blocks->Nth(i)->code.empty() && blocks->NumElements() > 2)
+      blocks->RemoveAt(i--);
+  }
+  Rebuild();
+}
+
+BasicBlock *FlowGraph::NewBlock()
+{
+  static int nextBlockNum = 0;
+  BasicBlock *b = new BasicBlock(nextBlockNum++);
+  blocks->Append(b);
+  return b;
+}
+
+BasicBlock *FlowGraph::NewBlockBefore(BasicBlock *b)
+{
+  BasicBlock *result = NewBlock();
+  blocks->RemoveAt(blocks->NumElements() - 1);
+  for (int i = 0; i < blocks->NumElements(); i++)
+    if (blocks->Nth(i) == b) {
+      blocks->InsertAt(result, i);
+      return result;
+    }
+  Assert(0); // b is not in this graph
+  return NULL;
+}
+
+BasicBlock *FlowGraph::NewBlockAtEnd()
+{
+  BasicBlock *last = blocks->Nth(blocks->NumElements() - 2);
+  Instruction *instr = last->GetLast();
+  if (instr && EndsBlock(instr) && FallsThrough(instr)) {
+    last = NewBlockBefore(exit);  // the branch must stay last in its block
+    instr = NULL;
+  }
+  if (FallsThrough(instr))
+    last->code.push_back(new Return(NULL));
+  return NewBlockBefore(exit);
+}
+
+void FlowGraph::MoveToEnd(BasicBlock *b)
+{
+  for (int i = 0; i < blocks->NumElements(); i++)
+    if (blocks->Nth(i) == b) {
+      blocks->RemoveAt(i);
+      blocks->InsertAt(b, blocks->NumElements() - 1);
+      return;
+    }
+  Assert(0); // b is not in this graph
+}
+
+BasicBlock *FlowGraph::FallThrough(BasicBlock *b)
+{
+  if (b == exit || !FallsThrough(b->GetLast())) return NULL;
+  for (int i = 0; i < blocks->NumElements() - 1; i++)
+    if (blocks->Nth(i) == b) return blocks->Nth(i + 1);
+  return NULL;
+}
+
+void FlowGraph::RemoveUnreachableBlocks()
+{
+  bool removed = false;
+  for (int i = 0; i < blocks->NumElements(); i++) {
+    BasicBlock *b = blocks->Nth(i);
+    if (!b->IsReachable() && b != exit && b != GetEntry()) {
+      blocks->RemoveAt(i--);
+      removed = true;
+    }
+  }
+  if (removed) Rebuild();
+}
+
+Location *FlowGraph::NewTemp(const char *tempName)
+{
+  int size = begin->GetFrameSize();
+  Location *result = new Location(fpRelative, CodeGenerator::OffsetToFirstLocal - size,
+                                  tempName ? tempName : CodeGenerator::NewTempName());
+  begin->SetFrameSize(size + CodeGenerator::VarSize);
+  return result;
+}
+
+void FlowGraph::AddEdge(BasicBlock *from, BasicBlock *to)
+{
+  for (int i = 0; i < from->succs->NumElements(); i++)
+    if (from->succs->Nth(i) == to) return;
+  from->succs->Append(to);
+  to->preds->Append(from);
+}
+
+
+/* Method: Rebuild
+ * ---------------
+ * Derives the edges from the block contents: the branch that ends a
+ * block (if any) names its target, and blocks that don't end in an
+ * unconditional transfer fall into the next block in layout order.
+ * Return leads to the exit block. Then the block order and dominator
+ * tree are recomputed.
+ */
+void FlowGraph::Rebuild()
+{
+  labels = new Hashtable<BasicBlock*>;
+  for (int i = 0; i < blocks->NumElements(); i++) {
+    BasicBlock *b = blocks->Nth(i);
+    b->succs = new List<BasicBlock*>;
+    b->preds = new List<BasicBlock*>;
+    std::list<Instruction*>::iterator p;
+    for (p = b->code.begin(); p != b->code.end(); ++p) {
+      Label *l = dynamic_cast<Label*>(*p);
+      if (l) labels->Enter(l->text(), b);
+    }
+  }
+
+  for (int i = 0; i < blocks->NumElements(); i++) {
+    BasicBlock *b = blocks->Nth(i);
+    if (b == exit) continue;
+    Instruction *last = b->GetLast();
+    const char *target = last ? BranchTarget(last) : NULL;
+    if (target) {
+      BasicBlock *t = labels->Lookup(target);
+      Assert(t != NULL);
+      AddEdge(b, t);
+    }
+    if (last && (dynamic_cast<Return*>(last) || IsHalt(last)))
+      AddEdge(b, exit);
+    else if (FallsThrough(last))
+      AddEdge(b, blocks->Nth(i + 1));
+  }
+
+  ComputeOrder();
+  ComputeDominators();
+  ComputeLoopDepths();
+}
+
+
+/* Method: ComputeOrder
+ * --------------------
+ * Numbers the reachable blocks in reverse postorder using an explicit
+ * stack (functions can be long enough that recursion is a concern).
+ * Unreachable blocks keep rpo -1.
+ */
+void FlowGraph::ComputeOrder()
+{
+  int n = blocks->NumElements();
+  for (int i = 0; i < n; i++)
+    blocks->Nth(i)->rpo = -1;
+
+  List<BasicBlock*> post;
+  List<BasicBlock*> stack;
+  List<int> next;
+  BasicBlock *entry = GetEntry();
+  entry->rpo = 0;   // used as "visited" mark during the walk
+  stack.Append(entry);
+  next.Append(0);
+  while (stack.NumElements() > 0) {
+    int top = stack.NumElements() - 1;
+    BasicBlock *b = stack.Nth(top);
+    int i = next.Nth(top);
+    if (i < b->succs->NumElements()) {
+      next.RemoveAt(top);
+      next.Append(i + 1);
+      BasicBlock *s = b->succs->Nth(i);
+      if (s->rpo < 0) {
+        s->rpo = 0;
+        stack.Append(s);
+        next.Append(0);
+      }
+    } else {
+      post.Append(b);
+      stack.RemoveAt(top);
+      next.RemoveAt(top);
+    }
+  }
+
+  rpoOrder = new List<BasicBlock*>;
+  for (int i = post.NumElements() - 1; i >= 0; i--) {
+    BasicBlock *b = post.Nth(i);
+    b->rpo = rpoOrder->NumElements();
+    rpoOrder->Append(b);
+  }
+}
+
+BasicBlock *FlowGraph::Intersect(BasicBlock *b1, BasicBlock *b2)
+{
+  while (b1 != b2) {
+    while (b1->rpo > b2->rpo) b1 = b1->idom;
+    while (b2->rpo > b1->rpo) b2 = b2->idom;
+  }
+  return b1;
+}
+
+void FlowGraph::ComputeDominators()
+{
+  for (int i = 0; i < blocks->NumElements(); i++) {
+    BasicBlock *b = blocks->Nth(i);
+    b->idom = NULL;
+    b->domChildren = new List<BasicBlock*>;
+  }
+
+  BasicBlock *entry = GetEntry();
+  entry->idom = entry;  // sentinel so Intersect terminates, cleared below
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = 1; i < rpoOrder->NumElements(); i++) {
+      BasicBlock *b = rpoOrder->Nth(i);
+      BasicBlock *newIdom = NULL;
+      for (int j = 0; j < b->preds->NumElements(); j++) {
+        BasicBlock *p = b->preds->Nth(j);
+        if (!p->idom) continue;   // not yet processed (or unreachable)
+        newIdom = newIdom ? Intersect(p, newIdom) : p;
+      }
+      if (newIdom != b->idom) {
+        b->idom = newIdom;
+        changed = true;
+      }
+    }
+  }
+  entry->idom = NULL;
+
+  for (int i = 1; i < rpoOrder->NumElements(); i++) {
+    BasicBlock *b = rpoOrder->Nth(i);
+    b->idom->domChildren->Append(b);
+  }
+}
+
+/* Method: LoopBody
+ * ----------------
+ * Collects the body of the natural loop of header (all back edges into
+ * the same header make up one loop) by walking backwards from the
+ * sources of its back edges. Returns false if header has no back edge.
+ */
+bool FlowGraph::LoopBody(BasicBlock *header, std::set<BasicBlock*> *body)
+{
+  List<BasicBlock*> work;
+  for (int j = 0; j < header->preds->NumElements(); j++) {
+    BasicBlock *p = header->preds->Nth(j);
+    if (Dominates(header, p)) work.Append(p);
+  }
+  if (work.NumElements() == 0) return false;
+  body->insert(header);
+  while (work.NumElements() > 0) {
+    BasicBlock *b = work.Nth(work.NumElements() - 1);
+    work.RemoveAt(work.NumElements() - 1);
+    if (!body->insert(b).second) continue;
+    for (int j = 0; j < b->preds->NumElements(); j++)
+      if (b->preds->Nth(j)->IsReachable()) work.Append(b->preds->Nth(j));
+  }
+  return true;
+}
+
+/* Method: ComputeLoopDepths
+ * -------------------------
+ * Counts for each block the number of loop bodies it belongs to.
+ */
+void FlowGraph::ComputeLoopDepths()
+{
+  for (int i = 0; i < blocks->NumElements(); i++)
+    blocks->Nth(i)->loopDepth = 0;
+
+  for (int i = 0; i < rpoOrder->NumElements(); i++) {
+    std::set<BasicBlock*> body;
+    if (!LoopBody(rpoOrder->Nth(i), &body)) continue;
+    std::set<BasicBlock*>::iterator p;
+    for (p = body.begin(); p != body.end(); ++p)
+      (*p)->loopDepth++;
+  }
+}
+
+/* Method: MakePreheader
+ * ----------------------
+ * When the loop is entered from a single block with no other successor
+ * that block already is the preheader. Otherwise a new block is made
+ * between the two: laid out right before the header if the entry falls
+ * through into it, else at the end of the function with a jump to the
+ * header. The phis of the header are updated to the new predecessor.
+ */
+BasicBlock *FlowGraph::MakePreheader(BasicBlock *header)
+{
+  std::set<BasicBlock*> body;
+  if (!LoopBody(header, &body)) return NULL;
+  BasicBlock *pred = NULL;
+  for (int i = 0; i < header->preds->NumElements(); i++) {
+    if (body.count(header->preds->Nth(i))) continue;
+    if (pred) return NULL;
+    pred = header->preds->Nth(i);
+  }
+  if (!pred) return NULL;
+  if (pred->succs->NumElements() == 1) return pred;
+
+  BasicBlock *result;
+  Instruction *branch = pred->GetLast();
+  if (BranchTarget(branch) && header->GetLabel()
+      && !strcmp(branch->branch_label(), header->GetLabel())) {
+    result = NewBlockAtEnd();
+    char *label = CodeGenerator::NewLabel();
+    result->code.push_back(new Label(label));
+    result->code.push_back(new Goto(header->GetLabel()));
+    branch->SetBranchLabel(label);
+  } else {
+    result = NewBlockBefore(header);
+  }
+  std::list<Instruction*>::iterator p;
+  for (p = header->code.begin(); p != header->code.end(); ++p)
+    if (dynamic_cast<Phi*>(*p))
+      dynamic_cast<Phi*>(*p)->ReplacePred(pred, result);
+  Rebuild();
+  return result;
+}
+
+bool FlowGraph::Dominates(BasicBlock *a, BasicBlock *b)
+{
+  if (!a->IsReachable() || !b->IsReachable()) return false;
+  while (b && b->rpo > a->rpo)
+    b = b->idom;
+  return b == a;
+}
+
+
+void FlowGraph::Linearize(std::list<Instruction*> &code)
+{
+  code.push_back(begin);
+  for (int i = 0; i < blocks->NumElements(); i++) {
+    BasicBlock *b = blocks->Nth(i);
+    code.insert(code.end(), b->code.begin(), b->code.end());
+  }
+}
+
+void FlowGraph::Print()
+{
+  printf("Function %s:\n", name);
+  begin->Print();
+  for (int i = 0; i < blocks->NumElements(); i++)
+    blocks->Nth(i)->Print();
+  printf("\n");
+}
@@ -0,0 +1,142 @@
+/* File: cfg.h
+ * -----------
+ * The FlowGraph class partitions the Tac instructions of a single
+ * function into basic blocks and links those blocks with successor
+ * and predecessor edges. It also computes the dominator tree over
+ * the blocks, which is the starting point for most of the analyses
+ * and transformations that want to reason about control flow.
+ *
+ * A function in the instruction stream looks like
+ *
+ *      fnLabel:
+ *          BeginFunc N
+ *          ...body...
+ *          EndFunc
+ *
+ * The body is split into blocks at every Label and after every
+ * Goto, IfZ, IfCompare, Return and call to _Halt. The EndFunc is kept in a block
+ * of its own (the exit block) that is always laid out last; falling
+ * off the end of the body, every Return and every _Halt lead to it
+ * (a _Halt never returns, so nothing after it is reached from it).
+ * The BeginFunc is held aside as the function prologue, it belongs
+ * to no block.
+ *
+ * Natural loops are found from the back edges (an edge whose target
+ * dominates its source) and each block records how deeply it is
+ * nested, which cost heuristics use to weigh instructions.
+ */
+
+#ifndef _H_cfg
+#define _H_cfg
+
+#include <list>
+#include <set>
+#include "list.h"
+#include "tac.h"
+#include "hashtable.h"
+
+class BasicBlock
+{
+  public:
+    int id;                           // unique within the graph, B<id>
+    std::list<Instruction*> code;     // Label (if any) first, branch last
+    List<BasicBlock*> *succs, *preds;
+
+    BasicBlock *idom;                 // immediate dominator, NULL for entry
+    List<BasicBlock*> *domChildren;   // children in the dominator tree
+    int rpo;                          // reverse postorder number, -1 if unreachable
+    int loopDepth;                    // number of natural loops containing block
+
+    BasicBlock(int id);
+
+    const char *GetLabel();           // label that starts this block, or NULL
+    Instruction *GetLast();           // last instruction, or NULL if empty
+    bool IsReachable() const { return rpo >= 0; }
+    void Print();
+};
+
+class FlowGraph
+{
+  protected:
+    const char *name;
+    BeginFunc *begin;
+    List<BasicBlock*> *blocks;        // in layout order, exit block last
+    List<BasicBlock*> *rpoOrder;      // reachable blocks in reverse postorder
+    BasicBlock *exit;
+    Hashtable<BasicBlock*> *labels;
+
+    BasicBlock *NewBlock();
+    void AddEdge(BasicBlock *from, BasicBlock *to);
+    void ComputeOrder();
+    void ComputeDominators();
+    void ComputeLoopDepths();
+    BasicBlock *Intersect(BasicBlock *b1, BasicBlock *b2);
+
+  public:
+         // Builds the graph for the function whose BeginFunc is
+         // first in code. Consumes instructions up to and including
+         // the matching EndFunc, removing them from code.
+    FlowGraph(const char *name, std::list<Instruction*> &code);
+
+    const char *GetName()             { return name; }
+    BeginFunc *GetBeginFunc()         { return begin; }
+    BasicBlock *GetEntry()            { return blocks->Nth(0); }
+    BasicBlock *GetExit()             { return exit; }
+    int NumBlocks()                   { return blocks->NumElements(); }
+    BasicBlock *Nth(int i)            { return blocks->Nth(i); }
+    List<BasicBlock*> *ReversePostorder() { return rpoOrder; }
+    BasicBlock *BlockForLabel(const char *label) { return labels->Lookup(label); }
+
+         // Returns true if every path from the entry to b passes
+         // through a. A block dominates itself.
+    bool Dominates(BasicBlock *a, BasicBlock *b);
+
+         // Adds the blocks of the natural loop headed by header to body
+         // (the header included). Returns false if header is not the
+         // target of a back edge and so heads no loop.
+    bool LoopBody(BasicBlock *header, std::set<BasicBlock*> *body);
+
+         // Returns the block every entry into the loop headed by header
+         // passes through, adding one if needed (which rebuilds the
+         // graph). NULL if header heads no loop or the loop is entered
+         // from several blocks.
+    BasicBlock *MakePreheader(BasicBlock *header);
+
+         // Recomputes edges, ordering and dominators after a pass has
+         // changed the blocks (moved branches, added/removed blocks)
+    void Rebuild();
+
+         // Adds an empty block to the layout right before b (which
+         // may be the exit block). Edges are not updated until Rebuild.
+    BasicBlock *NewBlockBefore(BasicBlock *b);
+
+         // Adds an empty block at the end of the layout (before the
+         // exit block) for code that is only reached by branching to
+         // it. Whatever fell through into the exit block before it now
+         // ends in an explicit Return. The new block needs a label.
+    BasicBlock *NewBlockAtEnd();
+
+         // Moves b to the end of the layout (before the exit block).
+         // Nothing is patched and edges are not updated until Rebuild.
+    void MoveToEnd(BasicBlock *b);
+
+         // The block control falls into from the end of b, or NULL if
+         // b always branches, returns or halts
+    BasicBlock *FallThrough(BasicBlock *b);
+
+         // Drops the blocks that can't be reached from the entry, and
+         // rebuilds the graph if there were any
+    void RemoveUnreachableBlocks();
+
+         // Creates a temp in a new slot of this function's frame (named
+         // like the code generator's temps unless a name is given)
+    Location *NewTemp(const char *name = NULL);
+
+         // Appends the instructions of the function, prologue first and
+         // blocks in layout order, back onto the end of code.
+    void Linearize(std::list<Instruction*> &code);
+
+    void Print();
+};
+
+#endif
@@ -7,8 +7,25 @@
 
 #include "codegen.h"
 #include <string.h>
+#include <vector>
 #include "tac.h"
 #include "mips.h"
+#include "cfg.h"
+#include "liveness.h"
+#include "regalloc.h"
+#include "ssa.h"
+#include "valuenum.h"
+#include "sccp.h"
+#include "dce.h"
+#include "licm.h"
+#include "bounds.h"
+#include "inline.h"
+#include "tailcall.h"
+#include "shrinkwrap.h"
+#include "stackmap.h"
+#include "escape.h"
+#include "layout.h"
+#include "strength.h"
 
 Location* CodeGenerator::ThisPtr= new Location(fpRelative, 4, "this");
   
@@ -17,6 +34,7 @@ CodeGenerator::CodeGenerator()
     curFunc = NULL;
     locals = 0;
     globals = 0;
+    ThisPtr->SetPointer(objectPointer);
 }
 
 char *CodeGenerator::NewLabel()
@@ -28,12 +46,18 @@ char *CodeGenerator::NewLabel()
 }
 
 
-Location *CodeGenerator::GenTempVar()
+char *CodeGenerator::NewTempName()
 {
   static int nextTempNum;
   char temp[10];
-  Location *result = NULL;
   sprintf(temp, "_tmp%d", nextTempNum++);
+  return strdup(temp);
+}
+
+Location *CodeGenerator::GenTempVar()
+{
+  Location *result = NULL;
+  char *temp = NewTempName();
   /* pp5: need to create variable in proper location
      in stack frame for use as temporary. Until you
      do that, the assert below will always fail to remind
@@ -50,7 +74,7 @@ Location *CodeGenerator::GenTempVar()
   return result;
 }
 
-Location *CodeGenerator::GenVar(const char *name)
+Location *CodeGenerator::GenVar(const char *name, PointerKind pointer)
 {
   Location *result;
   if (curFunc) {
@@ -59,7 +83,9 @@ Location *CodeGenerator::GenVar(const char *name)
   } else {
     result = new Location(gpRelative, OffsetToFirstGlobal + globals * VarSize, name);
     globals++;
+    if (pointer != notPointer) globalRoots.Append(result);
   }
+  result->SetPointer(pointer);
   return result;
 }
  
@@ -67,6 +93,7 @@ Location *CodeGenerator::GenLoadConstant(int value)
 {
   Location *result = GenTempVar();
   code.push_back(new LoadConstant(result, value));
+  constants[result] = value;
   return result;
 }
 
@@ -91,10 +118,10 @@ void CodeGenerator::GenAssign(Location *dst, Location *src)
 }
 
 
-Location *CodeGenerator::GenLoad(Location *ref, int offset)
+Location *CodeGenerator::GenLoad(Location *ref, int offset, bool isInvariant)
 {
   Location *result = GenTempVar();
-  code.push_back(new Load(result, ref, offset));
+  code.push_back(new Load(result, ref, offset, isInvariant));
   return result;
 }
 
@@ -104,11 +131,23 @@ void CodeGenerator::GenStore(Location *dst,Location *src, int offset)
 }
 
 
+/* Method: GenBinaryOp
+ * -------------------
+ * Operations on two constants are done right away (temps are assigned
+ * only once, so a temp loaded with a constant keeps it). The operands'
+ * loads stay, the caller may still use them.
+ */
 Location *CodeGenerator::GenBinaryOp(const char *opName, Location *op1,
 						     Location *op2)
 {
+  BinaryOp::OpCode opCode = BinaryOp::OpCodeForName(opName);
+  int value;
+  if (constants.count(op1) && constants.count(op2)
+      && BinaryOp::Evaluate(opCode, constants[op1], constants[op2], &value)) {
+    return GenLoadConstant(value);
+  }
   Location *result = GenTempVar();
-  code.push_back(new BinaryOp(BinaryOp::OpCodeForName(opName), result, op1, op2));
+  code.push_back(new BinaryOp(opCode, result, op1, op2));
   return result;
 }
 
@@ -123,6 +162,12 @@ void CodeGenerator::GenIfZ(Location *test, const char *label)
   code.push_back(new IfZ(test, label));
 }
 
+void CodeGenerator::GenIfCompare(const char *relation, Location *op1,
+                                 Location *op2, const char *label)
+{
+  code.push_back(new IfCompare(IfCompare::RelationForName(relation), op1, op2, label));
+}
+
 void CodeGenerator::GenGoto(const char *label)
 {
   code.push_back(new Goto(label));
@@ -190,6 +235,7 @@ static struct _builtin {
   {"_ReadLine", 0, true},
   {"_ReadInteger", 0, true},
   {"_StringEqual", 2, true},
+  {"_StringEqualLiteral", 2, true},
   {"_PrintInt", 1, false},
   {"_PrintString", 1, false},
   {"_PrintBool", 1, false},
@@ -213,16 +259,286 @@ Location *CodeGenerator::GenBuiltInCall(BuiltIn bn,Location *arg1, Location *arg
   return result;
 }
 
+Location *CodeGenerator::GenAlloc(Location *bytes, int kind)
+{
+  Location *result = GenTempVar();
+  code.push_back(new Allocate(result, bytes, kind));
+  return result;
+}
+
+/* Method: ExpandAllocs
+ * --------------------
+ * Replaces each Allocate left in a function by the allocation from the
+ * heap. __Heap holds the next free address of the current run,
+ * followed by the run's end. Both start out 0, so the first allocation
+ * refills. _Alloc may collect, so the header is only written once it
+ * returns. The expansion adds branches, so the graph is rebuilt if
+ * there was anything to expand.
+ */
+FlowGraph *CodeGenerator::ExpandAllocs(FlowGraph *graph)
+{
+  std::list<Instruction*> code;
+  graph->Linearize(code);
+  int expanded = 0;
+  std::list<Instruction*>::iterator p = code.begin();
+  while (p != code.end()) {
+    Allocate *alloc = dynamic_cast<Allocate*>(*p);
+    if (!alloc) {
+      ++p;
+      continue;
+    }
+    const char *fits = NewLabel(), *done = NewLabel();
+    Location *four = graph->NewTemp(), *size = graph->NewTemp();
+    Location *heap = graph->NewTemp(), *addr = graph->NewTemp();
+    Location *next = graph->NewTemp(), *end = graph->NewTemp();
+    Location *header = size;
+    std::list<Instruction*> seq;
+    seq.push_back(new LoadConstant(four, VarSize));
+    seq.push_back(new BinaryOp(BinaryOp::Add, size, alloc->GetBytes(), four));
+    seq.push_back(new LoadLabel(heap, "__Heap"));
+    seq.push_back(new Load(addr, heap));
+    seq.push_back(new BinaryOp(BinaryOp::Add, next, addr, size));
+    seq.push_back(new Load(end, heap, VarSize));
+    seq.push_back(new IfCompare(IfCompare::LessEq, next, end, fits));
+    seq.push_back(new PushParam(size));
+    seq.push_back(new LCall(builtins[Alloc].label, addr));
+    seq.push_back(new PopParams(VarSize));
+    seq.push_back(new Goto(done));
+    seq.push_back(new Label(fits));
+    seq.push_back(new Store(heap, next));
+    seq.push_back(new Label(done));
+    if (alloc->GetKind()) {
+      Location *kind = graph->NewTemp();
+      header = graph->NewTemp();
+      seq.push_back(new LoadConstant(kind, alloc->GetKind()));
+      seq.push_back(new BinaryOp(BinaryOp::Add, header, size, kind));
+    }
+    seq.push_back(new Store(addr, header));
+    seq.push_back(new BinaryOp(BinaryOp::Add, alloc->GetDef(), addr, four));
+    code.splice(p, seq);
+    p = code.erase(p);
+    expanded++;
+  }
+  if (expanded == 0) return graph;
+  return new FlowGraph(graph->GetName(), code);
+}
+
+bool CodeGenerator::IsBuiltIn(const char *label)
+{
+  for (int i = 0; i < NumBuiltIns; i++)
+    if (!strcmp(builtins[i].label, label)) return true;
+  return false;
+}
 
-void CodeGenerator::GenVTable(const char *className, List<const char *> *methodLabels)
+
+void CodeGenerator::GenVTable(const char *className, List<const char *> *methodLabels,
+                              List<int> *pointerFields)
 {
-  code.push_back(new VTable(className, methodLabels));
+  code.push_back(new VTable(className, methodLabels, pointerFields));
+}
+
+
+/* Method: Optimize
+ * ----------------
+ * Runs the machine independent optimizations on one function. They
+ * work on SSA form, which is printed (after optimization) with -d ssa.
+ */
+void CodeGenerator::Optimize(FlowGraph *graph)
+{
+  SSAForm ssa(graph);
+  ssa.Construct();
+
+  ConstantPropagation sccp(graph);
+  int blocks, removed = sccp.Run(&blocks);
+  PrintDebug("sccp", "%s: folded %d instructions, removed %d blocks",
+             graph->GetName(), removed, blocks);
+
+  if (graph->NumBlocks() <= GlobalValueNumbering::MaxBlocks) {
+    GlobalValueNumbering gvn(graph);
+    removed = gvn.Run();
+    PrintDebug("gvn", "%s: removed %d instructions", graph->GetName(), removed);
+  } else {
+    LocalValueNumbering lvn(graph);
+    removed = lvn.Run();
+    PrintDebug("lvn", "%s: removed %d instructions", graph->GetName(), removed);
+  }
+
+  CopyPropagation copies(graph);
+  removed = copies.Run();
+  PrintDebug("copyprop", "%s: removed %d copies", graph->GetName(), removed);
+
+  LoopInvariantCodeMotion licm(graph);
+  removed = licm.Run();
+  PrintDebug("licm", "%s: hoisted %d instructions", graph->GetName(), removed);
+
+  BoundsCheckElimination bounds(graph);
+  removed = bounds.Run();
+  PrintDebug("bounds", "%s: proved %d checks", graph->GetName(), removed);
+  if (removed > 0) {
+    ConstantPropagation again(graph);
+    again.Run(&blocks);
+  }
+
+  StrengthReduction strength(graph);
+  removed = strength.Run();
+  PrintDebug("strength", "%s: reduced %d instructions", graph->GetName(), removed);
+
+  DeadCodeElimination dce(graph);
+  removed = dce.Run();
+  PrintDebug("dce", "%s: removed %d instructions", graph->GetName(), removed);
+
+  if (IsDebugOn("ssa"))
+    graph->Print();
+  ssa.Destruct();
+}
+
+
+/* Method: NumberArguments
+ * -----------------------
+ * Tells each PushParam which argument of its call it is, for the
+ * register calling convention used when optimizing (see
+ * Mips::EmitParam). The arguments of a call are the pushes right
+ * before it, as many as it pops afterwards.
+ */
+void CodeGenerator::NumberArguments(FlowGraph *graph)
+{
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    std::vector<PushParam*> pushes;
+    std::list<Instruction*>::iterator p;
+    for (p = b->code.begin(); p != b->code.end(); ++p) {
+      if (dynamic_cast<PushParam*>(*p)) {
+        pushes.push_back(dynamic_cast<PushParam*>(*p));
+        continue;
+      }
+      if (!(*p)->IsCall()) continue;
+      std::list<Instruction*>::iterator next = p;
+      PopParams *pop = ++next == b->code.end() ? NULL : dynamic_cast<PopParams*>(*next);
+      TailCall *tail = dynamic_cast<TailCall*>(*p);
+      int count = (pop ? pop->GetNumBytes() : tail ? tail->GetNumBytes() : 0) / VarSize;
+      Assert(count <= (int)pushes.size());
+      for (int k = 0; k < count; k++)
+        pushes[pushes.size() - 1 - k]->SetArgument(k, count);
+      pushes.clear();
+    }
+  }
+}
+
+
+/* Method: BuildFlowGraphs
+ * -----------------------
+ * Splits the instruction list into functions and builds the flow
+ * graph of each one. Instructions outside of functions (vtables and
+ * the labels naming the functions) are kept in order in between.
+ * When optimizing, self calls in tail position become loops and small
+ * functions are inlined into their callers once all the graphs are
+ * built. Allocations that don't escape then move into the frame, the
+ * others are expanded (always), and each function is run through
+ * Optimize, the calls left in tail position reuse its frame and the
+ * blocks are laid out for the likely paths.
+ * Liveness marks the values the register cache can drop, and when
+ * optimizing registers are allocated for each function that is not
+ * too large for it. Last the temps left in memory are packed into
+ * shared stack slots, and (when optimizing) the places that save $ra
+ * are picked.
+ * The graphs are linearized back into the list once done with them.
+ */
+void CodeGenerator::BuildFlowGraphs()
+{
+  List<FlowGraph*> graphs;
+  std::list<Instruction*> outside;    // a NULL marks where a function goes
+  while (!code.empty()) {
+    Instruction *instr = code.front();
+    if (!dynamic_cast<BeginFunc*>(instr)) {
+      outside.push_back(instr);
+      code.pop_front();
+      continue;
+    }
+    Label *fnLabel = outside.empty() ? NULL : dynamic_cast<Label*>(outside.back());
+    Assert(fnLabel != NULL); // FnDecl::Emit labels every function
+    FlowGraph *graph = new FlowGraph(fnLabel->text(), code);
+    if (IsDebugOn("cfg"))
+      graph->Print();
+    graphs.Append(graph);
+    outside.push_back(NULL);
+  }
+
+  if (GetOptimizationLevel() > 0) {
+    for (int i = 0; i < graphs.NumElements(); i++) {
+      TailCalls tails(graphs.Nth(i));
+      int removed = tails.RemoveRecursion();
+      PrintDebug("tailcall", "%s: made %d self calls a loop", graphs.Nth(i)->GetName(), removed);
+    }
+    Inliner inliner(&graphs);
+    int inlined = inliner.Run();
+    PrintDebug("inline", "inlined %d calls", inlined);
+  }
+
+  int next = 0;
+  std::list<Instruction*>::iterator p;
+  for (p = outside.begin(); p != outside.end(); ++p) {
+    if (*p) {
+      code.push_back(*p);
+      continue;
+    }
+    FlowGraph *graph = graphs.Nth(next++);
+    int removed = 0;
+    if (GetOptimizationLevel() > 0) {
+      TailCalls tails(graph);
+      removed = tails.RemoveRecursion();        // those inlining made
+      EscapeAnalysis escape(graph);
+      int moved = escape.Run();
+      PrintDebug("escape", "%s: %d allocations moved to the frame", graph->GetName(), moved);
+    }
+    graph = ExpandAllocs(graph);
+    if (GetOptimizationLevel() > 0) {
+      Optimize(graph);
+      TailCalls tails(graph);
+      int turned = tails.ReuseFrames();
+      PrintDebug("tailcall", "%s: made %d more self calls a loop, %d calls reuse the frame",
+                 graph->GetName(), removed, turned);
+      BlockLayout layout(graph);
+      int rotated = layout.RotateLoops();
+      int cold = layout.MoveColdBlocks();
+      PrintDebug("layout", "%s: rotated %d loops, moved %d blocks ending in _Halt",
+                 graph->GetName(), rotated, cold);
+    }
+    StackMaps maps(graph);
+    int cleared = maps.ClearUninitialized();
+    Liveness live(graph);
+    live.MarkDeadValues();
+    int calls = maps.Record(&live);
+    PrintDebug("gc", "%s: %d calls may collect, %d pointers set to null on entry",
+               graph->GetName(), calls, cleared);
+    std::map<Location*, int> *registers = NULL;
+    if (GetOptimizationLevel() > 0 && live.NumVars() <= RegisterAllocator::MaxVariables) {
+      RegisterAllocator allocator(graph, &live);
+      registers = allocator.Allocate();
+      graph->GetBeginFunc()->SetRegisters(registers);
+    }
+    StackSlotAllocator slots(graph, &live, registers);
+    slots.Allocate();
+    if (GetOptimizationLevel() > 0) {
+      ShrinkWrap wrap(graph);
+      int saves = wrap.Run();
+      if (saves < 0)
+        PrintDebug("shrinkwrap", "%s: $ra saved in the prologue", graph->GetName());
+      else
+        PrintDebug("shrinkwrap", "%s: $ra saved in %d blocks%s", graph->GetName(), saves,
+                   graph->GetBeginFunc()->IsLeaf() ? " (leaf)" : "");
+      NumberArguments(graph);
+    }
+    graph->Linearize(code);
+  }
 }
 
 
 void CodeGenerator::DoFinalCodeGen()
 {
-  if (IsDebugOn("tac")) { // if debug don't translate to mips, just print Tac
+  BuildFlowGraphs();
+
+  if (IsDebugOn("cfg")) { // flow graphs were printed instead
+  } else if (IsDebugOn("tac")) { // if debug don't translate to mips, just print Tac
     std::list<Instruction*>::iterator p;
     for (p= code.begin(); p != code.end(); ++p) {
       (*p)->Print();
@@ -235,7 +551,6 @@ void CodeGenerator::DoFinalCodeGen()
     for (p= code.begin(); p != code.end(); ++p) {
       (*p)->Emit(&mips);
     }
+    mips.EmitRootMaps(&globalRoots);
   }
 }
-
-
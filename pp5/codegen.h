@@ -16,11 +16,13 @@
 
 #include <cstdlib>
 #include <list>
+#include <map>
 #include "tac.h"
+class FlowGraph;
  
 
               // These codes are used to identify the built-in functions
-typedef enum { Alloc, ReadLine, ReadInteger, StringEqual,
+typedef enum { Alloc, ReadLine, ReadInteger, StringEqual, StringEqualLiteral,
                PrintInt, PrintString, PrintBool, Halt, NumBuiltIns } BuiltIn;
 
 class CodeGenerator {
@@ -29,6 +31,13 @@ class CodeGenerator {
     int locals;
     int globals;
     BeginFunc *curFunc;
+    std::map<Location*, int> constants;  // temps holding a known constant
+    List<Location*> globalRoots;         // globals holding pointers
+
+    void BuildFlowGraphs();
+    void Optimize(FlowGraph *graph);
+    FlowGraph *ExpandAllocs(FlowGraph *graph);
+    void NumberArguments(FlowGraph *graph);
 
   public:
            // Here are some class constants to remind you of the offsets
@@ -52,9 +61,16 @@ class CodeGenerator {
     
          // Assigns a new unique label name and returns it. Does not
          // generate any Tac instructions (see GenLabel below if needed)
-    char *NewLabel();
+    static char *NewLabel();
+
+         // Returns a new unique name for a temp variable. Used by
+         // GenTempVar below and by optimization passes that need
+         // temps of their own (see FlowGraph::NewTemp)
+    static char *NewTempName();
 
-    Location *GenVar(const char *name);
+         // Creates the Location of a declared variable. The globals
+         // that are pointers are remembered as roots for the collector.
+    Location *GenVar(const char *name, PointerKind pointer = notPointer);
     
          // Creates and returns a Location for a new uniquely named
          // temp variable. Does not generate any Tac instructions
@@ -91,7 +107,10 @@ class CodeGenerator {
          // temporary variable where the result was stored. The optional
          // offset argument can be used to offset the addr by a positive or
          // negative number of bytes. If not given, 0 is assumed.
-    Location *GenLoad(Location *addr, int offset = 0);
+         // Loads of words that never change once allocated (an array's
+         // length, an object's vtable, vtable entries) should pass
+         // isInvariant so the optimizer can reuse and hoist them.
+    Location *GenLoad(Location *addr, int offset = 0, bool isInvariant = false);
 
     
          // Generates Tac instructions to perform one of the binary ops
@@ -138,13 +157,30 @@ class CodeGenerator {
          // is created and NULL is returned.
     Location *GenBuiltInCall(BuiltIn b, Location *arg1 = NULL, Location *arg2 = NULL);
 
+         // Generates the Tac instruction to allocate the given number
+         // of bytes, which ExpandAllocs turns into a bump of the
+         // runtime's heap pointer (__Heap in defs.asm) unless escape
+         // analysis found it can live in the frame. The word before
+         // the bytes gets a header for the collector: the size, plus
+         // ObjectHeader for an object or the PointerKind of an array's
+         // elements. Returns a Location for the new temp var holding
+         // the address.
+    Location *GenAlloc(Location *bytes, int kind);
+    static const int ObjectHeader = 3;
+
+         // Whether label is one of the built-in functions above
+    static bool IsBuiltIn(const char *label);
+
     
          // These methods generate the Tac instructions for various
          // control flow (branches, jumps, returns, labels)
          // One minor detail to mention is that you can pass NULL
          // (or omit arg) to GenReturn for a return that does not
-         // return a value
+         // return a value. GenIfCompare jumps if op1 relation op2
+         // holds, relation being one of < <= > >= == !=
     void GenIfZ(Location *test, const char *label);
+    void GenIfCompare(const char *relation, Location *op1, Location *op2,
+                      const char *label);
     void GenGoto(const char *label);
     void GenReturn(Location *val = NULL);
     void GenLabel(const char *label);
@@ -161,7 +197,8 @@ class CodeGenerator {
          // methods in the order they should be laid out.  The vtable
          // is tagged with a label of the class name, so when you later
          // need access to the vtable, you use LoadLabel of class name.
-    void GenVTable(const char *className, List<const char*> *methodLabels);
+    void GenVTable(const char *className, List<const char*> *methodLabels,
+                   List<int> *pointerFields);
 
 
          // Emits the final "object code" for the program by
@@ -170,6 +207,8 @@ class CodeGenerator {
          // flag tac is on (-d tac), it will not translate to MIPS,
          // but instead just print the untranslated Tac. It may be
          // useful in debugging to first make sure your Tac is correct.
+         // With -d cfg it prints the basic blocks, edges and dominators
+         // of each function instead.
     void DoFinalCodeGen();
 };
 
@@ -0,0 +1,110 @@
+/* File: dce.cc
+ * ------------
+ * Implementation of copy propagation and dead code elimination.
+ */
+
+#include "dce.h"
+#include "cfg.h"
+#include <set>
+
+
+int CopyPropagation::Run()
+{
+  std::map<Location*, Location*> copies;
+  int removed = 0;
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    std::list<Instruction*>::iterator p = b->code.begin();
+    while (p != b->code.end()) {
+      Assign *copy = dynamic_cast<Assign*>(*p);
+      if (copy && copy->GetDef()->GetSegment() == fpRelative
+          && copy->GetSrc()->GetSegment() == fpRelative) {
+        copies[copy->GetDef()] = copy->GetSrc();
+        p = b->code.erase(p);
+        removed++;
+      } else {
+        ++p;
+      }
+    }
+  }
+
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    std::list<Instruction*>::iterator p;
+    for (p = b->code.begin(); p != b->code.end(); ++p) {
+      List<Location*> uses;
+      (*p)->GetUses(&uses);
+      for (int j = 0; j < uses.NumElements(); j++) {
+        Location *to = uses.Nth(j);
+        while (copies.count(to)) to = copies[to];
+        if (to != uses.Nth(j)) (*p)->ReplaceUse(uses.Nth(j), to);
+      }
+    }
+  }
+  return removed;
+}
+
+
+bool DeadCodeElimination::IsRemovable(Instruction *instr)
+{
+  Location *dst = instr->GetDef();
+  if (!dst || dst->GetSegment() != fpRelative) return false;
+  BinaryOp *op = dynamic_cast<BinaryOp*>(instr);
+  if (op && (op->GetCode() == BinaryOp::Div || op->GetCode() == BinaryOp::Mod)) {
+    LoadConstant *divisor = dynamic_cast<LoadConstant*>(defs[op->GetOp2()]);
+    return divisor && divisor->GetValue() != 0;
+  }
+  return op || dynamic_cast<Assign*>(instr) || dynamic_cast<LoadConstant*>(instr)
+    || dynamic_cast<LoadStringConstant*>(instr) || dynamic_cast<LoadLabel*>(instr)
+    || dynamic_cast<Phi*>(instr);
+}
+
+int DeadCodeElimination::Run()
+{
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    std::list<Instruction*>::iterator p;
+    for (p = b->code.begin(); p != b->code.end(); ++p)
+      if ((*p)->GetDef()) defs[(*p)->GetDef()] = *p;
+  }
+
+  std::set<Instruction*> needed;
+  List<Instruction*> work;
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    std::list<Instruction*>::iterator p;
+    for (p = b->code.begin(); p != b->code.end(); ++p)
+      if (!IsRemovable(*p)) {
+        needed.insert(*p);
+        work.Append(*p);
+      }
+  }
+  while (work.NumElements() > 0) {
+    Instruction *instr = work.Nth(work.NumElements() - 1);
+    work.RemoveAt(work.NumElements() - 1);
+    List<Location*> uses;
+    instr->GetUses(&uses);
+    for (int j = 0; j < uses.NumElements(); j++) {
+      Instruction *def = defs.count(uses.Nth(j)) ? defs[uses.Nth(j)] : NULL;
+      if (def && !needed.count(def)) {
+        needed.insert(def);
+        work.Append(def);
+      }
+    }
+  }
+
+  int removed = 0;
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    std::list<Instruction*>::iterator p = b->code.begin();
+    while (p != b->code.end()) {
+      if (needed.count(*p)) {
+        ++p;
+      } else {
+        p = b->code.erase(p);
+        removed++;
+      }
+    }
+  }
+  return removed;
+}
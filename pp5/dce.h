@@ -0,0 +1,55 @@
+/* File: dce.h
+ * -----------
+ * Cleanup passes over a function in SSA form.
+ *
+ * CopyPropagation removes every copy x = y between stack variables and
+ * renames the uses of x to y. In SSA form neither is ever redefined,
+ * so y holds the same value wherever x was used. Copies to or from
+ * globals are real memory accesses and stay.
+ *
+ * DeadCodeElimination deletes the computations whose results are never
+ * needed. Instructions with effects beyond their result (stores, calls
+ * and their parameters, branches, returns, anything writing a global,
+ * and loads, which may fault) are needed; so is every definition of a
+ * value a needed instruction uses. Anything not reached that way is
+ * dead, including cycles of phis around a loop that feed only each
+ * other. A division is only removed if its divisor is a non-zero
+ * constant, since dividing by zero stops the program.
+ */
+
+#ifndef _H_dce
+#define _H_dce
+
+#include <map>
+#include "tac.h"
+
+class FlowGraph;
+
+class CopyPropagation
+{
+  protected:
+    FlowGraph *graph;
+
+  public:
+    CopyPropagation(FlowGraph *graph) : graph(graph) {}
+
+         // Returns the number of copies removed
+    int Run();
+};
+
+class DeadCodeElimination
+{
+  protected:
+    FlowGraph *graph;
+    std::map<Location*, Instruction*> defs;
+
+    bool IsRemovable(Instruction *instr);
+
+  public:
+    DeadCodeElimination(FlowGraph *graph) : graph(graph) {}
+
+         // Returns the number of instructions removed
+    int Run();
+};
+
+#endif
@@ -43,69 +43,28 @@ end:	move $sp, $fp
 	lw $fp, 0($fp)
 	jr $ra
 
+# Objects and arrays are carved out of chunks taken from sbrk. The
+# compiled code bumps __Heap itself while the current chunk has room
+# and calls _Alloc only when it doesn't: a new chunk is started (the
+# rest of the old one is left unused), or a request bigger than a chunk
+# gets memory of its own.
 _Alloc:
-        subu $sp, $sp, 8
-        sw $fp, 8($sp)
-        sw $ra, 4($sp)
-        addiu $fp, $sp, 8
-        li   $v0, 9
-        lw $a0, 4($fp)
-	syscall
-        move $sp, $fp
-        lw $ra, -4($fp)
-        lw $fp, 0($fp) 
-        jr $ra
-
+	lw $a0, 4($sp)
+	b __Alloc
 
+# _StringEqual and _StringEqualLiteral share the register entries
+# below, and neither needs a frame. Strings that are both word-aligned
+# (the string constants and the ReadLine buffer are) are compared four
+# bytes at a time.
 _StringEqual:
-	subu $sp, $sp, 8      # decrement sp to make space to save ra, fp
-	sw $fp, 8($sp)        # save fp
-	sw $ra, 4($sp)        # save ra
-	addiu $fp, $sp, 8     # set up new fp
-	subu $sp, $sp, 4      # decrement sp to make space for locals/temps
-
-	li $v0,0
-
-	#Determine length string 1
-	lw $t0, 4($fp)       
-	li $t3,0
-bloop1: 
-	lb $t5, ($t0) 
-	beqz $t5, eloop1	
-	addi $t0, 1
-	addi $t3, 1
-	b bloop1
-eloop1:
-
-	#Determine length string 2
-	lw $t1, 8($fp)
-	li $t4,0
-bloop2: 
-	lb $t5, ($t1) 
-	beqz $t5, eloop2	
-	addi $t1, 1
-	addi $t4, 1
-	b bloop2
-eloop2:
-	bne $t3,$t4,end1       #Check String Lengths Same
-
-	lw $t0, 4($fp)       
-	lw $t1, 8($fp)
-	li $t3, 0     		
-bloop3:	
-	lb $t5, ($t0) 
-	lb $t6, ($t1) 
-	bne $t5, $t6, end1
-	addi $t3, 1
-	addi $t0, 1
-	addi $t1, 1
-	bne $t3,$t4,bloop3
-eloop3:	li $v0,1
+	lw $a0, 4($sp)
+	lw $a1, 8($sp)
+	b __StringEqual
 
-end1:	move $sp, $fp         # pop callee frame off stack
-	lw $ra, -4($fp)       # restore saved ra
-	lw $fp, 0($fp)        # restore saved fp
-	jr $ra                # return from function
+_StringEqualLiteral:
+	lw $a0, 4($sp)
+	lw $a1, 8($sp)
+	b __StringEqualLiteral
 
 _Halt:
         li $v0, 10
@@ -154,7 +113,431 @@ eloop4:
 	jr $ra
 	
 
+# Entry points for code compiled with -O, which passes the arguments
+# in $a0 and $a1 (the caller still makes room for them on the stack)
+
+__PrintInt:
+	li   $v0, 1
+	syscall
+	jr $ra
+
+__PrintString:
+	li   $v0, 4
+	syscall
+	jr $ra
+
+__PrintBool:
+	move $t1, $a0
+	la   $a0, TRUE
+	bgtz $t1, rbr
+	la   $a0, FALSE
+rbr:	li   $v0, 4
+	syscall
+	jr $ra
+
+# Allocates $a0 bytes (header included) from the heap. The inline code
+# in each function has already found the current run too small; the
+# rest of it is sealed off and the next free run taken, and once they
+# are used up the heap either grows by a chunk or, when it has grown
+# past its limit, is collected first.
+
+__Alloc:
+	la $t2, __Heap
+	lw $v0, 0($t2)
+	addu $t0, $v0, $a0
+	lw $t1, 4($t2)
+	bgt $t0, $t1, arefill
+	sw $t0, 0($t2)        # it fits after all
+	jr $ra
+arefill:
+	subu $sp, $sp, 12
+	sw $ra, 4($sp)
+	sw $a0, 8($sp)
+	sw $zero, 12($sp)     # whether we have collected
+	jal __Seal
+anext:	la $t2, __Heap
+	lw $t3, 8($t2)        # the next free run
+	beqz $t3, agrow
+	lw $t4, 4($t3)
+	sw $t4, 8($t2)
+	lw $t4, 0($t3)
+	addu $t4, $t3, $t4    # its end
+	sw $t3, 0($t2)
+	sw $t4, 4($t2)
+	move $t5, $t3
+azero:	sw $zero, 0($t5)      # so reused memory starts out zeroed too
+	addiu $t5, $t5, 4
+	blt $t5, $t4, azero
+	subu $t4, $t4, $t3
+	lw $a0, 8($sp)
+	bge $t4, $a0, aretry
+	jal __Seal            # too small, try the next
+	b anext
+agrow:	lw $t3, 12($sp)
+	bnez $t3, anew
+	lw $t3, 16($t2)
+	lw $t4, 20($t2)
+	blt $t3, $t4, anew
+	li $t3, 1
+	sw $t3, 12($sp)
+	lw $a0, 4($sp)        # the return address into the innermost frame
+	jal __Collect
+	b anext
+anew:	lw $a0, 8($sp)
+	addiu $a0, $a0, 8     # the chunk's link and end come first
+	li $t1, 32768         # the chunk size
+	bge $a0, $t1, abig
+	move $a0, $t1
+abig:	li $v0, 9
+	syscall
+	la $t2, __Heap
+	lw $t3, 12($t2)
+	sw $t3, 0($v0)
+	addu $t4, $v0, $a0
+	sw $t4, 4($v0)
+	sw $v0, 12($t2)
+	lw $t3, 16($t2)
+	addu $t3, $t3, $a0
+	sw $t3, 16($t2)
+	lw $t3, 24($t2)
+	bnez $t3, ahigh
+	sw $v0, 24($t2)       # sbrk only grows, so the first chunk is lowest
+ahigh:	sw $t4, 28($t2)
+	addiu $t3, $v0, 8
+	sw $t3, 0($t2)
+	sw $t4, 4($t2)
+aretry:	lw $ra, 4($sp)
+	lw $a0, 8($sp)
+	addiu $sp, $sp, 12
+	b __Alloc
+
+# Turns the rest of the current run into a block with no pointers, so
+# the heap can still be walked a block at a time.
+
+__Seal:
+	la $t2, __Heap
+	lw $t0, 0($t2)
+	lw $t1, 4($t2)
+	subu $t1, $t1, $t0
+	blez $t1, sdone
+	sw $t1, 0($t0)
+sdone:	sw $zero, 0($t2)
+	sw $zero, 4($t2)
+	jr $ra
+
+# Mark-sweep collection. $a0 is the return address into the innermost
+# Decaf frame, which is $fp. The roots are the globals listed in
+# __GlobalRoots and, for each frame up to main, the slots and registers
+# the stack map for its call site lists. A register a frame doesn't
+# save is found where the frames inside it saved it, or in __GCRegs;
+# __GCLocs tracks where each of $s0-$s7 is for the frame being read.
+# Marked blocks wait on a stack below $sp to be scanned. The sweep then
+# joins the unmarked blocks of each chunk into free runs, and the heap
+# may grow to twice what survived before the next collection.
+
+__Collect:
+	subu $sp, $sp, 4
+	sw $ra, 4($sp)
+	la $t0, __GCRegs
+	sw $s0, 0($t0)
+	sw $s1, 4($t0)
+	sw $s2, 8($t0)
+	sw $s3, 12($t0)
+	sw $s4, 16($t0)
+	sw $s5, 20($t0)
+	sw $s6, 24($t0)
+	sw $s7, 28($t0)
+	la $t1, __GCLocs
+	li $t2, 8
+cloc:	sw $t0, 0($t1)
+	addiu $t0, $t0, 4
+	addiu $t1, $t1, 4
+	addi $t2, $t2, -1
+	bnez $t2, cloc
+	move $s0, $a0
+	move $s1, $fp
+	move $s6, $sp         # the bottom of the mark stack
+	la $s2, __GlobalRoots
+	lw $s3, 0($s2)
+cglobal:
+	beqz $s3, cframe
+	addiu $s2, $s2, 4
+	lw $t0, 0($s2)
+	andi $a1, $t0, 3
+	subu $t0, $t0, $a1
+	addu $t0, $t0, $gp
+	lw $a0, 0($t0)
+	jal __Mark
+	addi $s3, $s3, -1
+	b cglobal
+cframe:	la $t0, __StackMaps
+cfind:	lw $t1, 0($t0)
+	beqz $t1, cmark       # past main
+	beq $t1, $s0, cfound
+	lw $t2, 4($t0)
+	lw $t3, 8($t0)
+	addu $t2, $t2, $t3
+	lw $t3, 12($t0)
+	sll $t3, $t3, 1
+	addu $t2, $t2, $t3
+	sll $t2, $t2, 2
+	addu $t0, $t0, $t2
+	addiu $t0, $t0, 16
+	b cfind
+cfound:	lw $s3, 4($t0)        # slots
+	lw $s4, 8($t0)        # registers
+	lw $s5, 12($t0)       # registers the frame saved
+	addiu $s2, $t0, 16
+cslot:	beqz $s3, creg
+	lw $t0, 0($s2)
+	andi $a1, $t0, 3
+	subu $t0, $t0, $a1
+	addu $t0, $t0, $s1
+	lw $a0, 0($t0)
+	jal __Mark
+	addiu $s2, $s2, 4
+	addi $s3, $s3, -1
+	b cslot
+creg:	beqz $s4, csaved
+	lw $t0, 0($s2)
+	andi $a1, $t0, 3
+	subu $t0, $t0, $a1
+	la $t1, __GCLocs
+	addu $t0, $t0, $t1
+	lw $t0, 0($t0)
+	lw $a0, 0($t0)
+	jal __Mark
+	addiu $s2, $s2, 4
+	addi $s4, $s4, -1
+	b creg
+csaved:	beqz $s5, cnext
+	lw $t0, 0($s2)
+	lw $t1, 4($s2)
+	addu $t1, $t1, $s1
+	sll $t0, $t0, 2
+	la $t2, __GCLocs
+	addu $t0, $t0, $t2
+	sw $t1, 0($t0)        # the caller's value is here
+	addiu $s2, $s2, 8
+	addi $s5, $s5, -1
+	b csaved
+cnext:	lw $s0, -4($s1)       # the return address into the caller
+	lw $s1, 0($s1)        # and its frame
+	b cframe
+cmark:	beq $sp, $s6, csweep
+	lw $s2, 4($sp)        # a marked block to scan
+	addiu $sp, $sp, 4
+	lw $t0, 0($s2)
+	andi $s5, $t0, 3
+	beqz $s5, cmark
+	li $t1, 3
+	beq $s5, $t1, cobject
+	lw $s3, 4($s2)        # an array of pointers of kind $s5
+	addiu $s4, $s2, 8
+celem:	blez $s3, cmark
+	lw $a0, 0($s4)
+	move $a1, $s5
+	jal __Mark
+	addiu $s4, $s4, 4
+	addi $s3, $s3, -1
+	b celem
+cobject:
+	lw $t0, 4($s2)        # the vtable, with its pointer fields below
+	lw $s3, -4($t0)
+	addiu $s4, $t0, -8
+cfield:	blez $s3, cmark
+	lw $t0, 0($s4)
+	andi $a1, $t0, 3
+	subu $t0, $t0, $a1
+	addu $t0, $t0, $s2
+	lw $a0, 4($t0)
+	jal __Mark
+	addiu $s4, $s4, -4
+	addi $s3, $s3, -1
+	b cfield
+csweep:	la $t0, __Heap
+	sw $zero, 8($t0)
+	li $s5, 0             # free bytes
+	li $s7, 0x7fffffff
+	lw $s0, 12($t0)
+cchunk:	beqz $s0, cdone
+	addiu $s2, $s0, 8
+	lw $s3, 4($s0)
+	li $s4, 0             # where the free run being built starts
+cblock:	bge $s2, $s3, cend
+	lw $t0, 0($s2)
+	and $t1, $t0, $s7
+	andi $t2, $t1, 3
+	subu $s1, $t1, $t2    # its size
+	bgez $t0, cdead
+	sw $t1, 0($s2)
+	jal cclose
+	b cstep
+cdead:	bnez $s4, cstep
+	move $s4, $s2
+cstep:	addu $s2, $s2, $s1
+	b cblock
+cend:	jal cclose
+	lw $s0, 0($s0)
+	b cchunk
+cdone:	la $t0, __Heap
+	lw $t1, 16($t0)
+	subu $t1, $t1, $s5
+	sll $t1, $t1, 1
+	li $t2, 65536
+	bge $t1, $t2, climit
+	move $t1, $t2
+climit:	sw $t1, 20($t0)
+	la $t0, __GCRegs
+	lw $s0, 0($t0)
+	lw $s1, 4($t0)
+	lw $s2, 8($t0)
+	lw $s3, 12($t0)
+	lw $s4, 16($t0)
+	lw $s5, 20($t0)
+	lw $s6, 24($t0)
+	lw $s7, 28($t0)
+	lw $ra, 4($sp)
+	addiu $sp, $sp, 4
+	jr $ra
+cclose:	beqz $s4, ccdone      # ends the free run at $s2, if any
+	subu $t0, $s2, $s4
+	addu $s5, $s5, $t0
+	sw $t0, 0($s4)
+	li $t1, 8
+	blt $t0, $t1, ccshort # no room for the link
+	la $t1, __Heap
+	lw $t2, 8($t1)
+	sw $t2, 4($s4)
+	sw $s4, 8($t1)
+ccshort:
+	li $s4, 0
+ccdone:	jr $ra
+
+# Marks the block $a0 points into, with $a1 saying how: 1 to an object,
+# 2 to an array, 3 into the middle of one (the block is then found by
+# walking its chunk). An object or array outside the heap is in a frame
+# (see escape.h); nothing points to those but locals, so they are
+# scanned each time without being marked.
+
+__Mark:
+	beqz $a0, mdone
+	la $t0, __Heap
+	lw $t1, 24($t0)
+	blt $a0, $t1, mframe
+	lw $t1, 28($t0)
+	bge $a0, $t1, mframe
+	li $t1, 1
+	beq $a1, $t1, mobject
+	li $t1, 2
+	beq $a1, $t1, marray
+	lw $t1, 12($t0)
+mchunk:	beqz $t1, mdone
+	addiu $t3, $t1, 8
+	lw $t2, 4($t1)
+	blt $a0, $t3, mnext
+	blt $a0, $t2, mwalk
+mnext:	lw $t1, 0($t1)
+	b mchunk
+mwalk:	lw $t4, 0($t3)
+	li $t5, 0x7ffffffc
+	and $t4, $t4, $t5
+	beqz $t4, mdone
+	addu $t4, $t4, $t3
+	blt $a0, $t4, mfound
+	move $t3, $t4
+	b mwalk
+mframe:	li $t1, 3
+	beq $a1, $t1, mdone   # their elements are never pointers
+	sll $t3, $a1, 2
+	subu $t3, $a0, $t3    # the header, 4 or 8 bytes back
+	b mpush
+mobject:
+	addiu $t3, $a0, -4
+	b mfound
+marray:	addiu $t3, $a0, -8
+mfound:	lw $t4, 0($t3)
+	bltz $t4, mdone       # marked already
+	lui $t5, 0x8000
+	or $t4, $t4, $t5
+	sw $t4, 0($t3)
+mpush:	subu $sp, $sp, 4
+	sw $t3, 4($sp)
+mdone:	jr $ra
+
+__StringEqual:
+	li $v0, 1
+	beq $a0, $a1, seqdone   # the same string
+	or $t0, $a0, $a1
+	andi $t0, $t0, 3
+	bnez $t0, seqbyte       # not both word-aligned
+	li $t3, 0x01010101
+	sll $t4, $t3, 7         # 0x80808080
+seqword:
+	lw $t0, ($a0)
+	lw $t1, ($a1)
+	bne $t0, $t1, seqbyte   # they differ in this word, find out where
+	subu $t2, $t0, $t3      # nonzero if the word has a zero byte
+	nor $t5, $t0, $zero
+	and $t2, $t2, $t5
+	and $t2, $t2, $t4
+	bnez $t2, seqdone       # equal up to the null
+	addiu $a0, $a0, 4
+	addiu $a1, $a1, 4
+	b seqword
+seqbyte:
+	lb $t0, ($a0)
+	lb $t1, ($a1)
+	bne $t0, $t1, seqfalse
+	beqz $t0, seqdone
+	addiu $a0, $a0, 1
+	addiu $a1, $a1, 1
+	b seqbyte
+seqfalse:
+	li $v0, 0
+seqdone:
+	jr $ra
+
+# The second argument is a string constant, with its length in the
+# word before it, so exactly that many bytes and the null are compared.
+__StringEqualLiteral:
+	li $v0, 1
+	beq $a0, $a1, seqdone
+	lw $t2, -4($a1)         # the length of the constant
+	addiu $t2, $t2, 1       # and its null
+	andi $t0, $a0, 3
+	bnez $t0, sllbyte
+sllword:
+	slti $t0, $t2, 4
+	bnez $t0, sllbyte
+	lw $t0, ($a0)
+	lw $t1, ($a1)
+	bne $t0, $t1, seqfalse
+	addiu $a0, $a0, 4
+	addiu $a1, $a1, 4
+	addiu $t2, $t2, -4
+	b sllword
+sllbyte:
+	beqz $t2, seqdone
+	lb $t0, ($a0)
+	lb $t1, ($a1)
+	bne $t0, $t1, seqfalse
+	addiu $a0, $a0, 1
+	addiu $a1, $a1, 1
+	addiu $t2, $t2, -1
+	b sllbyte
+
+
 	.data
 TRUE:.asciiz "true"
 FALSE:.asciiz "false"
+	.align 2
+__Heap:	.word 0, 0     # next free address in the current run, its end
+	.word 0        # free runs
+	.word 0        # chunks
+	.word 0        # bytes in all chunks
+	.word 65536    # collect rather than grow past this
+	.word 0, 0     # lowest and highest heap address
+__GCRegs: .word 0, 0, 0, 0, 0, 0, 0, 0
+__GCLocs: .word 0, 0, 0, 0, 0, 0, 0, 0
 SPACE:.asciiz "Making Space For Inputed Values Is Fun."
@@ -0,0 +1,123 @@
+/* File: escape.cc
+ * ---------------
+ * Implementation of the escape analysis.
+ */
+
+#include "escape.h"
+#include "cfg.h"
+#include "codegen.h"
+#include <set>
+
+
+EscapeAnalysis::EscapeAnalysis(FlowGraph *g)
+{
+  graph = g;
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    int n = 0;
+    std::list<Instruction*>::iterator p;
+    for (p = b->code.begin(); p != b->code.end(); ++p) {
+      blocks[*p] = b;
+      positions[*p] = n++;
+      Location *def = (*p)->GetDef();
+      if (!def) continue;
+      if (!defs.count(def)) defs[def] = new List<Instruction*>;
+      defs[def]->Append(*p);
+    }
+  }
+}
+
+// Whether a runs before b on every path to b.
+bool EscapeAnalysis::Before(Instruction *a, Instruction *b)
+{
+  if (blocks[a] == blocks[b]) return positions[a] < positions[b];
+  return graph->Dominates(blocks[a], blocks[b]);
+}
+
+// The value of var where user reads it, if var is set only once, to a
+// constant, before user.
+bool EscapeAnalysis::Constant(Location *var, Instruction *user, int *value, int depth)
+{
+  if (depth > 8 || !defs.count(var) || defs[var]->NumElements() != 1) return false;
+  Instruction *def = defs[var]->Nth(0);
+  if (!Before(def, user)) return false;
+  if (dynamic_cast<LoadConstant*>(def)) {
+    *value = dynamic_cast<LoadConstant*>(def)->GetValue();
+    return true;
+  }
+  if (dynamic_cast<Assign*>(def))
+    return Constant(dynamic_cast<Assign*>(def)->GetSrc(), def, value, depth + 1);
+  BinaryOp *op = dynamic_cast<BinaryOp*>(def);
+  int a, b;
+  return op && Constant(op->GetOp1(), def, &a, depth + 1)
+            && Constant(op->GetOp2(), def, &b, depth + 1)
+            && BinaryOp::Evaluate(op->GetCode(), a, b, value);
+}
+
+bool EscapeAnalysis::Escapes(Location *addr)
+{
+  std::set<Location*> seen;
+  List<Location*> work;
+  seen.insert(addr);
+  work.Append(addr);
+  while (work.NumElements() > 0) {
+    Location *var = work.Nth(work.NumElements() - 1);
+    work.RemoveAt(work.NumElements() - 1);
+    if (var->GetSegment() == gpRelative) return true;
+    for (int i = 0; i < graph->NumBlocks(); i++) {
+      BasicBlock *b = graph->Nth(i);
+      std::list<Instruction*>::iterator p;
+      for (p = b->code.begin(); p != b->code.end(); ++p) {
+        Instruction *instr = *p;
+        List<Location*> uses;
+        instr->GetUses(&uses);
+        bool used = false;
+        for (int j = 0; j < uses.NumElements(); j++)
+          if (uses.Nth(j) == var) used = true;
+        if (!used) continue;
+
+        Store *store = dynamic_cast<Store*>(instr);
+        BinaryOp *op = dynamic_cast<BinaryOp*>(instr);
+        Location *copy = NULL;
+        if (dynamic_cast<Assign*>(instr))
+          copy = instr->GetDef();
+        else if (op && (op->GetCode() == BinaryOp::Add || op->GetCode() == BinaryOp::Sub))
+          copy = op->GetDef();
+        else if (store) {
+          if (store->GetSrc() == var) return true;
+        } else if (!op && !dynamic_cast<Load*>(instr) && !dynamic_cast<IfZ*>(instr)
+                   && !dynamic_cast<IfCompare*>(instr))
+          return true;
+        if (copy && !seen.count(copy)) {
+          seen.insert(copy);
+          work.Append(copy);
+        }
+      }
+    }
+  }
+  return false;
+}
+
+int EscapeAnalysis::Run()
+{
+  int moved = 0, total = 0;
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    if (b->loopDepth > 0 || !b->IsReachable()) continue;
+    std::list<Instruction*>::iterator p;
+    for (p = b->code.begin(); p != b->code.end(); ++p) {
+      Allocate *alloc = dynamic_cast<Allocate*>(*p);
+      int bytes;
+      if (!alloc || !Constant(alloc->GetBytes(), alloc, &bytes) || bytes <= 0)
+        continue;
+      int kind = alloc->GetKind(), size = bytes + CodeGenerator::VarSize;
+      if ((kind != notPointer && kind != CodeGenerator::ObjectHeader)
+          || size > MaxBlock || total + size > MaxFrame || Escapes(alloc->GetDef()))
+        continue;
+      *p = new StackBlock(alloc->GetDef(), size, size + kind);
+      total += size;
+      moved++;
+    }
+  }
+  return moved;
+}
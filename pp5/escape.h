@@ -0,0 +1,54 @@
+/* File: escape.h
+ * --------------
+ * Escape analysis, done on each function once inlining is over. An
+ * Allocate whose address never leaves the function (it is never
+ * stored into memory, passed, returned or kept in a global) can only
+ * be reached through the function's own variables, so its block may
+ * live in the frame: it is cleared and given its header there, the
+ * garbage collector scans it like any other block but never frees it,
+ * and _Alloc is not called at all.
+ *
+ * The address is followed through copies and pointer arithmetic; any
+ * use not known to be harmless (a load from it, a store into it, a
+ * comparison) counts as an escape. Only allocations of a size known
+ * at compile time that run at most once per call (outside loops) move,
+ * and only small ones, so frames don't grow without bound. Arrays of
+ * pointers stay on the heap: a loop may keep only the address of an
+ * element (see strength.h), which tells the collector nothing for a
+ * block outside the heap.
+ */
+
+#ifndef _H_escape
+#define _H_escape
+
+#include <map>
+#include "list.h"
+#include "tac.h"
+
+class FlowGraph;
+class BasicBlock;
+
+class EscapeAnalysis
+{
+  protected:
+    FlowGraph *graph;
+    std::map<Location*, List<Instruction*>*> defs;
+    std::map<Instruction*, BasicBlock*> blocks;
+    std::map<Instruction*, int> positions;
+
+    bool Before(Instruction *a, Instruction *b);
+    bool Constant(Location *var, Instruction *user, int *value, int depth = 0);
+    bool Escapes(Location *addr);
+
+  public:
+    static const int MaxBlock = 128;    // bytes, header included
+    static const int MaxFrame = 512;    // bytes of blocks per function
+
+    EscapeAnalysis(FlowGraph *graph);
+
+         // Turns the Allocates that don't escape into StackBlocks.
+         // Returns the number turned.
+    int Run();
+};
+
+#endif
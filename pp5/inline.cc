@@ -0,0 +1,199 @@
+/* File: inline.cc
+ * ---------------
+ * Implementation of the inliner.
+ */
+
+#include "inline.h"
+#include "cfg.h"
+#include "codegen.h"
+#include "utility.h"
+#include <string.h>
+#include <string>
+
+
+Inliner::Inliner(List<FlowGraph*> *g)
+{
+  graphs = g;
+  for (int i = 0; i < graphs->NumElements(); i++)
+    AddCallee(graphs->Nth(i));
+}
+
+/* Method: AddCallee
+ * -----------------
+ * Remembers the body of a function that doesn't call itself (any but
+ * main). Methods are only reached by LCalls once devirtualized, and
+ * this is then simply their first parameter.
+ */
+void Inliner::AddCallee(FlowGraph *graph)
+{
+  const char *name = graph->GetName();
+  if (name[0] != '_') return;
+  Callee *callee = new Callee;
+  callee->name = name;
+  callee->size = 0;
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    std::list<Instruction*>::iterator p;
+    for (p = b->code.begin(); p != b->code.end(); ++p) {
+      if (dynamic_cast<EndFunc*>(*p)) continue;
+      LCall *call = dynamic_cast<LCall*>(*p);
+      if (call && !strcmp(call->GetLabel(), name)) return;
+      callee->body.push_back(*p);
+      if (!dynamic_cast<Label*>(*p)) callee->size++;
+    }
+  }
+  callees.Enter(name, callee);
+}
+
+// A fresh instruction with the same operands (Label and Return are
+// rewritten by Splice instead)
+Instruction *Inliner::Copy(Instruction *instr)
+{
+  if (dynamic_cast<LoadConstant*>(instr))
+    return new LoadConstant(*dynamic_cast<LoadConstant*>(instr));
+  if (dynamic_cast<LoadStringConstant*>(instr))
+    return new LoadStringConstant(*dynamic_cast<LoadStringConstant*>(instr));
+  if (dynamic_cast<LoadLabel*>(instr))
+    return new LoadLabel(*dynamic_cast<LoadLabel*>(instr));
+  if (dynamic_cast<Assign*>(instr))
+    return new Assign(*dynamic_cast<Assign*>(instr));
+  if (dynamic_cast<Load*>(instr))
+    return new Load(*dynamic_cast<Load*>(instr));
+  if (dynamic_cast<Store*>(instr))
+    return new Store(*dynamic_cast<Store*>(instr));
+  if (dynamic_cast<BinaryOp*>(instr))
+    return new BinaryOp(*dynamic_cast<BinaryOp*>(instr));
+  if (dynamic_cast<Goto*>(instr))
+    return new Goto(*dynamic_cast<Goto*>(instr));
+  if (dynamic_cast<IfZ*>(instr))
+    return new IfZ(*dynamic_cast<IfZ*>(instr));
+  if (dynamic_cast<IfCompare*>(instr))
+    return new IfCompare(*dynamic_cast<IfCompare*>(instr));
+  if (dynamic_cast<PushParam*>(instr))
+    return new PushParam(*dynamic_cast<PushParam*>(instr));
+  if (dynamic_cast<PopParams*>(instr))
+    return new PopParams(*dynamic_cast<PopParams*>(instr));
+  if (dynamic_cast<LCall*>(instr))
+    return new LCall(*dynamic_cast<LCall*>(instr));
+  if (dynamic_cast<ACall*>(instr))
+    return new ACall(*dynamic_cast<ACall*>(instr));
+  if (dynamic_cast<Allocate*>(instr))
+    return new Allocate(*dynamic_cast<Allocate*>(instr));
+  Failure("Unexpected Tac instruction in function body");
+  return NULL;
+}
+
+/* Method: Splice
+ * --------------
+ * Replaces the call (with the pushes before it and the pop after it)
+ * by a copy of the callee's body, and leaves call on the instruction
+ * following the copy. Returns false, changing nothing, if the
+ * arguments aren't pushed right before the call.
+ */
+bool Inliner::Splice(FlowGraph *caller, BasicBlock *b,
+                     std::list<Instruction*>::iterator &call, Callee *callee)
+{
+  // no PopParams follows a call without arguments
+  std::list<Instruction*>::iterator first = call, last = call;
+  PopParams *pop = ++last == b->code.end() ? NULL : dynamic_cast<PopParams*>(*last);
+  if (pop) ++last;
+  int numArgs = pop ? pop->GetNumBytes() / CodeGenerator::VarSize : 0;
+  std::map<int, Location*> args;      // by offset in the callee's frame
+  for (int k = 0; k < numArgs; k++) {
+    if (first == b->code.begin()) return false;
+    PushParam *push = dynamic_cast<PushParam*>(*--first);
+    if (!push) return false;
+    args[CodeGenerator::OffsetToFirstParam + k * CodeGenerator::VarSize] = push->GetParam();
+  }
+
+  std::list<Instruction*> copy;
+  std::map<Location*, Location*> locations;
+  std::map<std::string, const char*> labels;
+  for (size_t i = 0; i < callee->body.size(); i++) {
+    Instruction *instr = callee->body[i];
+    Label *label = dynamic_cast<Label*>(instr);
+    if (label) labels[label->text()] = CodeGenerator::NewLabel();
+    List<Location*> used;
+    instr->GetUses(&used);
+    if (instr->GetDef()) used.Append(instr->GetDef());
+    for (int j = 0; j < used.NumElements(); j++) {
+      Location *loc = used.Nth(j);
+      if (loc->GetSegment() != fpRelative || locations.count(loc)) continue;
+      locations[loc] = caller->NewTemp(loc->GetName());
+      locations[loc]->SetPointer(loc->GetPointer());
+      if (args.count(loc->GetOffset()))
+        copy.push_back(new Assign(locations[loc], args[loc->GetOffset()]));
+    }
+  }
+
+  Location *result = dynamic_cast<LCall*>(*call)->GetDef();
+  const char *end = CodeGenerator::NewLabel();
+  for (size_t i = 0; i < callee->body.size(); i++) {
+    Instruction *instr = callee->body[i];
+    Label *label = dynamic_cast<Label*>(instr);
+    Return *ret = dynamic_cast<Return*>(instr);
+    if (label) {
+      copy.push_back(new Label(labels[label->text()]));
+    } else if (ret) {
+      if (result && ret->GetValue())
+        copy.push_back(new Assign(result, locations.count(ret->GetValue())
+                                  ? locations[ret->GetValue()] : ret->GetValue()));
+      copy.push_back(new Goto(end));
+    } else {
+      Instruction *c = Copy(instr);
+      List<Location*> used;
+      c->GetUses(&used);
+      for (int j = 0; j < used.NumElements(); j++)
+        if (locations.count(used.Nth(j)))
+          c->ReplaceUse(used.Nth(j), locations[used.Nth(j)]);
+      if (c->GetDef() && locations.count(c->GetDef()))
+        c->SetDef(locations[c->GetDef()]);
+      if (c->branch_label() && labels.count(c->branch_label()))
+        c->SetBranchLabel(labels[c->branch_label()]);
+      copy.push_back(c);
+    }
+  }
+  copy.push_back(new Label(end));
+
+  b->code.insert(first, copy.begin(), copy.end());
+  call = b->code.erase(first, last);
+  return true;
+}
+
+
+int Inliner::Run()
+{
+  int inlined = 0;
+  for (int i = 0; i < graphs->NumElements(); i++) {
+    FlowGraph *graph = graphs->Nth(i);
+    int grown = 0, sites = 0;
+    for (int j = 0; j < graph->NumBlocks(); j++) {
+      BasicBlock *b = graph->Nth(j);
+      std::list<Instruction*>::iterator p = b->code.begin();
+      while (p != b->code.end()) {
+        LCall *call = dynamic_cast<LCall*>(*p);
+        Callee *callee = call ? callees.Lookup(call->GetLabel()) : NULL;
+        bool inLoop = b->loopDepth > 0;
+        if (!callee || !strcmp(callee->name, graph->GetName())
+            || !(callee->size <= MaxSize || (inLoop && callee->size <= MaxLoopSize))
+            || grown + callee->size > Budget || !Splice(graph, b, p, callee)) {
+          ++p;
+          continue;
+        }
+        PrintDebug("inline", "%s: inlined %s (%d instructions%s)", graph->GetName(),
+                   callee->name, callee->size, inLoop ? ", in a loop" : "");
+        grown += callee->size;
+        sites++;
+      }
+    }
+    if (sites == 0) continue;
+
+    // the copies put labels and branches in the middle of blocks
+    std::list<Instruction*> code;
+    graph->Linearize(code);
+    graphs->RemoveAt(i);
+    graphs->InsertAt(new FlowGraph(graph->GetName(), code), i);
+    inlined += sites;
+  }
+  return inlined;
+}
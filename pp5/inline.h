@@ -0,0 +1,67 @@
+/* File: inline.h
+ * --------------
+ * Inlining of small functions, done on the flow graphs of the
+ * whole program before each function is optimized. A call site
+ *
+ *      PushParam b ;  PushParam a ;  t = LCall _f ;  PopParams 8 ;
+ *
+ * is replaced by a copy of the body of _f in which every parameter,
+ * local and temp of _f is a new temp of the caller, the parameters
+ * are assigned from the arguments up front, the labels are renamed,
+ * and each Return assigns t and jumps to a label after the copy.
+ *
+ * The cost model weighs the size of the callee (its instruction
+ * count) against the call overhead it saves: tiny functions are
+ * inlined everywhere, somewhat larger ones only into loops where
+ * the overhead is paid over and over, and each caller may only grow
+ * by a fixed budget. Methods are inlined only where the call was
+ * devirtualized (the others are ACalls), and functions that call
+ * themselves never are. Only the bodies as written
+ * are copied, so what was inlined into a callee is not copied again.
+ */
+
+#ifndef _H_inline
+#define _H_inline
+
+#include <list>
+#include <map>
+#include <vector>
+#include "list.h"
+#include "tac.h"
+#include "hashtable.h"
+
+class FlowGraph;
+class BasicBlock;
+
+class Inliner
+{
+  protected:
+    struct Callee {
+      const char *name;
+      std::vector<Instruction*> body;   // BeginFunc and EndFunc left out
+      int size;
+    };
+    List<FlowGraph*> *graphs;
+    Hashtable<Callee*> callees;
+
+    void AddCallee(FlowGraph *graph);
+    bool Splice(FlowGraph *caller, BasicBlock *b,
+                std::list<Instruction*>::iterator &call, Callee *callee);
+
+  public:
+         // A copy of an instruction of a function body, with the same
+         // operands
+    static Instruction *Copy(Instruction *instr);
+
+    static const int MaxSize = 12;      // instructions, inlined anywhere
+    static const int MaxLoopSize = 40;  // inlined into loops
+    static const int Budget = 200;      // growth allowed per caller
+
+    Inliner(List<FlowGraph*> *graphs);
+
+         // Inlines into every function, replacing the graphs that
+         // changed by rebuilt ones. Returns the number of calls inlined.
+    int Run();
+};
+
+#endif
@@ -0,0 +1,113 @@
+/* File: layout.cc
+ * ---------------
+ * Implementation of the block layout.
+ */
+
+#include "layout.h"
+#include "cfg.h"
+#include "codegen.h"
+#include "inline.h"
+#include <map>
+#include <set>
+#include <string.h>
+
+
+// The label b starts with, adding one if it has none.
+const char *BlockLayout::LabelOf(BasicBlock *b)
+{
+  if (b->GetLabel()) return b->GetLabel();
+  const char *label = CodeGenerator::NewLabel();
+  b->code.push_front(new Label(label));
+  return label;
+}
+
+bool BlockLayout::Halts(BasicBlock *b)
+{
+  LCall *call = dynamic_cast<LCall*>(b->GetLast());
+  return call && !strcmp(call->GetLabel(), "_Halt");
+}
+
+bool BlockLayout::Rotate(BasicBlock *header)
+{
+  std::set<BasicBlock*> body;
+  IfCompare *test = dynamic_cast<IfCompare*>(header->GetLast());
+  if (!test || !graph->LoopBody(header, &body)) return false;
+  BasicBlock *exit = graph->BlockForLabel(test->branch_label());
+  BasicBlock *top = graph->FallThrough(header);
+  if (!exit || body.count(exit) || !top || !body.count(top)) return false;
+
+  BasicBlock *latch = NULL;
+  for (int i = 0; i < header->preds->NumElements(); i++) {
+    BasicBlock *p = header->preds->Nth(i);
+    if (!body.count(p)) continue;
+    if (latch) return false;
+    latch = p;
+  }
+  if (!dynamic_cast<Goto*>(latch->GetLast())) return false;
+  int size = header->code.size() - (header->GetLabel() ? 1 : 0);
+  if (size > MaxHeader) return false;
+
+  latch->code.pop_back();
+  std::list<Instruction*>::iterator p = header->code.begin();
+  if (header->GetLabel()) ++p;
+  for (; *p != test; ++p)
+    latch->code.push_back(Inliner::Copy(*p));
+  latch->code.push_back(new IfCompare(IfCompare::Negate(test->GetRelation()),
+                                      test->GetOp1(), test->GetOp2(), LabelOf(top)));
+  for (int i = 0; i < graph->NumBlocks() - 1; i++) {
+    if (graph->Nth(i) != latch) continue;
+    BasicBlock *next = graph->Nth(i + 1);
+    if (next != exit)
+      graph->NewBlockBefore(next)->code.push_back(new Goto(LabelOf(exit)));
+    break;
+  }
+  return true;
+}
+
+int BlockLayout::RotateLoops()
+{
+  List<BasicBlock*> headers;
+  for (int i = 0; i < graph->NumBlocks(); i++)
+    headers.Append(graph->Nth(i));
+  int rotated = 0;
+  for (int i = 0; i < headers.NumElements(); i++)
+    if (Rotate(headers.Nth(i))) rotated++;
+  if (rotated) graph->Rebuild();
+  return rotated;
+}
+
+int BlockLayout::MoveColdBlocks()
+{
+  List<BasicBlock*> cold;
+  std::map<BasicBlock*, BasicBlock*> fallsTo;
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    fallsTo[b] = graph->FallThrough(b);
+    if (Halts(b) && b != graph->GetEntry()) cold.Append(b);
+  }
+  if (cold.NumElements() == 0) return 0;
+  for (int i = 0; i < cold.NumElements(); i++)
+    graph->MoveToEnd(cold.Nth(i));
+
+  for (int i = 0; i < graph->NumBlocks() - 1; i++) {
+    BasicBlock *b = graph->Nth(i), *next = graph->Nth(i + 1), *to = fallsTo[b];
+    if (!to || to == next) continue;
+    IfCompare *branch = dynamic_cast<IfCompare*>(b->GetLast());
+    if (branch && graph->BlockForLabel(branch->branch_label()) == next) {
+      b->code.pop_back();
+      b->code.push_back(new IfCompare(IfCompare::Negate(branch->GetRelation()),
+                                      branch->GetOp1(), branch->GetOp2(), LabelOf(to)));
+      continue;
+    }
+    BasicBlock *jump = b;
+    if (b->GetLast() && b->GetLast()->branch_label())
+      jump = graph->NewBlockBefore(next);   // the branch stays last in b
+    if (to == graph->GetExit())
+      jump->code.push_back(new Return(NULL));
+    else
+      jump->code.push_back(new Goto(LabelOf(to)));
+    if (jump != b) i++;
+  }
+  graph->Rebuild();
+  return cold.NumElements();
+}
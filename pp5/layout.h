@@ -0,0 +1,59 @@
+/* File: layout.h
+ * --------------
+ * Orders the blocks of an optimized function so the likely way out of
+ * each falls through, using static guesses (there is no profile): a
+ * loop goes around again, and a path that ends in _Halt (a failed
+ * array check, a bad array size) is never taken.
+ *
+ * A while or for loop is emitted with its test at the top and a Goto
+ * back up at the bottom, two branches per iteration:
+ *
+ *      L1: If i >= n Goto L2 ;  body ;  Goto L1 ;  L2:
+ *
+ * RotateLoops copies the test over the Goto, with the relation
+ * negated so it branches back to the top of the body, and leaves the
+ * first test to guard the loop's entry:
+ *
+ *      L1: If i >= n Goto L2 ;  L3: body ;  If i < n Goto L3 ;  L2:
+ *
+ * Only a header of a single block (with no more than MaxHeader
+ * instructions) ending in an IfCompare that leaves the loop is copied,
+ * and only into a latch ending in the loop's one back edge. This runs
+ * after Optimize, whose passes expect the test to dominate the body.
+ *
+ * MoveColdBlocks then moves the blocks that end in _Halt after all the
+ * others. A branch around one is negated to branch to it instead, and
+ * a block whose fall-through successor moved away gets a Goto (or a
+ * Return, for the end of the function).
+ */
+
+#ifndef _H_layout
+#define _H_layout
+
+#include "tac.h"
+
+class FlowGraph;
+class BasicBlock;
+
+class BlockLayout
+{
+  protected:
+    FlowGraph *graph;
+
+    const char *LabelOf(BasicBlock *b);
+    bool Rotate(BasicBlock *header);
+    static bool Halts(BasicBlock *b);
+
+  public:
+    static const int MaxHeader = 8;     // instructions copied per loop
+
+    BlockLayout(FlowGraph *graph) : graph(graph) {}
+
+         // Returns the number of loops rotated
+    int RotateLoops();
+
+         // Returns the number of blocks moved
+    int MoveColdBlocks();
+};
+
+#endif
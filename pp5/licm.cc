@@ -0,0 +1,147 @@
+/* File: licm.cc
+ * -------------
+ * Implementation of loop-invariant code motion.
+ */
+
+#include "licm.h"
+#include "cfg.h"
+
+
+bool LoopInvariantCodeMotion::CanMove(Instruction *instr, BasicBlock *b,
+                                      BasicBlock *header, bool memoryChanges,
+                                      bool callSeen)
+{
+  Location *dst = instr->GetDef();
+  if (!dst || dst->GetSegment() != fpRelative) return false;
+  BinaryOp *op = dynamic_cast<BinaryOp*>(instr);
+  if (op && (op->GetCode() == BinaryOp::Div || op->GetCode() == BinaryOp::Mod)) {
+    LoadConstant *divisor = dynamic_cast<LoadConstant*>(defs[op->GetOp2()]);
+    return divisor && divisor->GetValue() != 0;
+  }
+  if (op && (op->GetCode() == BinaryOp::Add || op->GetCode() == BinaryOp::Sub)) {
+    if (b == header && !callSeen) return true;
+    LoadConstant *a = dynamic_cast<LoadConstant*>(defs[op->GetOp1()]);
+    LoadConstant *c = dynamic_cast<LoadConstant*>(defs[op->GetOp2()]);
+    int result;
+    return a && c && BinaryOp::Evaluate(op->GetCode(), a->GetValue(), c->GetValue(), &result);
+  }
+  Load *load = dynamic_cast<Load*>(instr);
+  if (load)
+    return b == header && !callSeen && (load->IsInvariant() || !memoryChanges);
+  return op || dynamic_cast<Assign*>(instr) || dynamic_cast<LoadConstant*>(instr)
+    || dynamic_cast<LoadStringConstant*>(instr) || dynamic_cast<LoadLabel*>(instr);
+}
+
+/* Method: HoistFrom
+ * -----------------
+ * Finds the invariant instructions of the loop headed by header and
+ * moves them to its preheader. They are collected in an order where
+ * every one comes after the invariant instructions it uses.
+ */
+int LoopInvariantCodeMotion::HoistFrom(BasicBlock *header)
+{
+  std::set<BasicBlock*> body;
+  if (!graph->LoopBody(header, &body)) return 0;
+
+  defBlock.clear();
+  defs.clear();
+  bool memoryChanges = false, callInLoop = false;
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    std::list<Instruction*>::iterator p;
+    for (p = b->code.begin(); p != b->code.end(); ++p) {
+      if ((*p)->GetDef()) {
+        defBlock[(*p)->GetDef()] = b;
+        defs[(*p)->GetDef()] = *p;
+      }
+      if (body.count(b) && (dynamic_cast<Store*>(*p) || (*p)->IsCall()))
+        memoryChanges = true;
+      if (body.count(b) && (*p)->IsCall())
+        callInLoop = true;
+    }
+  }
+
+  std::set<Location*> invariant;
+  List<Instruction*> moved;
+  List<BasicBlock*> from;
+  List<BasicBlock*> *order = graph->ReversePostorder();
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = 0; i < order->NumElements(); i++) {
+      BasicBlock *b = order->Nth(i);
+      if (!body.count(b)) continue;
+      bool callSeen = false;
+      std::list<Instruction*>::iterator p;
+      for (p = b->code.begin(); p != b->code.end(); ++p) {
+        if ((*p)->IsCall()) callSeen = true;
+        if (invariant.count((*p)->GetDef()) || !CanMove(*p, b, header, memoryChanges, callSeen))
+          continue;
+        List<Location*> uses;
+        (*p)->GetUses(&uses);
+        bool operandsInvariant = true;
+        for (int j = 0; j < uses.NumElements(); j++) {
+          Location *use = uses.Nth(j);
+          if (use->GetSegment() != fpRelative
+              || (defBlock.count(use) && body.count(defBlock[use]) && !invariant.count(use)))
+            operandsInvariant = false;
+        }
+        if (!operandsInvariant) continue;
+        invariant.insert((*p)->GetDef());
+        moved.Append(*p);
+        from.Append(b);
+        changed = true;
+      }
+    }
+  }
+
+  // A constant is as cheap to load in the loop as it would be to
+  // reload from a spill, so it only moves out if a moved instruction
+  // needs it. In a loop with calls anything moved out has to live in a
+  // callee-saved register, which only pays off for loads.
+  std::set<Location*> needed;
+  for (int i = moved.NumElements() - 1; i >= 0; i--) {
+    Instruction *instr = moved.Nth(i);
+    bool constant = dynamic_cast<LoadConstant*>(instr) || dynamic_cast<LoadLabel*>(instr);
+    if (!needed.count(instr->GetDef()) && !dynamic_cast<Load*>(instr)
+        && (constant || callInLoop)) {
+      moved.RemoveAt(i);
+      from.RemoveAt(i);
+      continue;
+    }
+    List<Location*> uses;
+    instr->GetUses(&uses);
+    for (int j = 0; j < uses.NumElements(); j++)
+      needed.insert(uses.Nth(j));
+  }
+  if (moved.NumElements() == 0) return 0;
+
+  BasicBlock *preheader = graph->MakePreheader(header);
+  if (!preheader) return 0;
+  std::list<Instruction*>::iterator end = preheader->code.end();
+  Instruction *last = preheader->GetLast();
+  if (last && last->branch_label())
+    --end;
+  for (int i = 0; i < moved.NumElements(); i++) {
+    from.Nth(i)->code.remove(moved.Nth(i));
+    preheader->code.insert(end, moved.Nth(i));
+  }
+  return moved.NumElements();
+}
+
+
+int LoopInvariantCodeMotion::Run()
+{
+  List<BasicBlock*> headers;
+  List<BasicBlock*> *order = graph->ReversePostorder();
+  for (int i = order->NumElements() - 1; i >= 0; i--) {
+    std::set<BasicBlock*> body;
+    if (graph->LoopBody(order->Nth(i), &body))
+      headers.Append(order->Nth(i));
+  }
+
+  int hoisted = 0;
+  for (int i = 0; i < headers.NumElements(); i++)
+    hoisted += HoistFrom(headers.Nth(i));
+  return hoisted;
+}
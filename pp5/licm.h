@@ -0,0 +1,52 @@
+/* File: licm.h
+ * ------------
+ * Loop-invariant code motion over a function in SSA form. The natural
+ * loops are handled innermost first, so what is hoisted out of an
+ * inner loop can be hoisted again out of the outer one.
+ *
+ * Each loop gets a preheader (FlowGraph::MakePreheader), the block
+ * through which every entry into the loop passes.
+ *
+ * An instruction is invariant if each of its operands is defined
+ * outside the loop or by another invariant instruction. In SSA form
+ * such an instruction can simply move to the end of the preheader.
+ * Only instructions that can't fail are moved, since the loop may not
+ * run at all: constants, labels, copies and arithmetic that wraps (not
+ * division unless by a non-zero constant). Add and sub trap on overflow
+ * and a Load may fail on a null base, so these are only moved from the
+ * header, which runs whenever the preheader does, and only if no call
+ * comes before them there (an add or sub of two constants that don't
+ * overflow can move from anywhere). A Load also has to be an invariant
+ * load (Load::IsInvariant) or the loop must contain no Store or call.
+ */
+
+#ifndef _H_licm
+#define _H_licm
+
+#include <map>
+#include <set>
+#include "list.h"
+#include "tac.h"
+
+class FlowGraph;
+class BasicBlock;
+
+class LoopInvariantCodeMotion
+{
+  protected:
+    FlowGraph *graph;
+    std::map<Location*, BasicBlock*> defBlock;
+    std::map<Location*, Instruction*> defs;
+
+    bool CanMove(Instruction *instr, BasicBlock *b, BasicBlock *header,
+                 bool memoryChanges, bool callSeen);
+    int HoistFrom(BasicBlock *header);
+
+  public:
+    LoopInvariantCodeMotion(FlowGraph *graph) : graph(graph) {}
+
+         // Returns the number of instructions hoisted
+    int Run();
+};
+
+#endif
@@ -0,0 +1,142 @@
+/* File: liveness.cc
+ * -----------------
+ * Implementation of the live variable analysis. The block sets are
+ * solved with the usual backwards iterative algorithm, visiting the
+ * blocks in postorder so most information flows in a single pass.
+ */
+
+#include "liveness.h"
+#include "cfg.h"
+
+
+bool VarSet::Union(const VarSet &other)
+{
+  bool changed = false;
+  for (size_t i = 0; i < bits.size(); i++) {
+    unsigned int merged = bits[i] | other.bits[i];
+    if (merged != bits[i]) {
+      bits[i] = merged;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+
+void Liveness::AddVar(Location *loc)
+{
+  if (!loc || loc->GetSegment() != fpRelative || index.count(loc)) return;
+  index[loc] = vars->NumElements();
+  vars->Append(loc);
+}
+
+int Liveness::Index(Location *loc)
+{
+  std::map<Location*, int>::iterator p = index.find(loc);
+  return p == index.end() ? -1 : p->second;
+}
+
+void Liveness::Transfer(Instruction *instr, VarSet &live)
+{
+  int def = Index(instr->GetDef());
+  if (def >= 0) live.Clear(def);
+  List<Location*> uses;
+  instr->GetUses(&uses);
+  for (int i = 0; i < uses.NumElements(); i++) {
+    int use = Index(uses.Nth(i));
+    if (use >= 0) live.Set(use);
+  }
+}
+
+
+Liveness::Liveness(FlowGraph *g)
+{
+  graph = g;
+  vars = new List<Location*>;
+
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    std::list<Instruction*>::iterator p;
+    for (p = b->code.begin(); p != b->code.end(); ++p) {
+      AddVar((*p)->GetDef());
+      List<Location*> uses;
+      (*p)->GetUses(&uses);
+      for (int j = 0; j < uses.NumElements(); j++)
+        AddVar(uses.Nth(j));
+    }
+  }
+
+  // local (upward exposed) uses and defs of each block
+  std::map<BasicBlock*, VarSet> gen, kill;
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    VarSet g(NumVars()), k(NumVars());
+    std::list<Instruction*>::reverse_iterator p;
+    for (p = b->code.rbegin(); p != b->code.rend(); ++p) {
+      int def = Index((*p)->GetDef());
+      if (def >= 0) {
+        k.Set(def);
+        g.Clear(def);
+      }
+      List<Location*> uses;
+      (*p)->GetUses(&uses);
+      for (int j = 0; j < uses.NumElements(); j++) {
+        int use = Index(uses.Nth(j));
+        if (use >= 0) g.Set(use);
+      }
+    }
+    gen[b] = g;
+    kill[b] = k;
+    liveIn[b] = g;
+    liveOut[b] = VarSet(NumVars());
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = graph->NumBlocks() - 1; i >= 0; i--) {
+      BasicBlock *b = graph->Nth(i);
+      VarSet &out = liveOut[b];
+      for (int j = 0; j < b->succs->NumElements(); j++)
+        out.Union(liveIn[b->succs->Nth(j)]);
+
+      // in = gen + (out - kill)
+      VarSet in(NumVars());
+      for (int v = 0; v < NumVars(); v++)
+        if (gen[b].Test(v) || (out.Test(v) && !kill[b].Test(v)))
+          in.Set(v);
+      if (!(in == liveIn[b])) {
+        liveIn[b] = in;
+        changed = true;
+      }
+    }
+  }
+}
+
+
+/* Method: MarkDeadValues
+ * ----------------------
+ * Walks every block backwards from its live-out set; an operand that
+ * is not live after an instruction is dead after it. That covers the
+ * last use of a value as well as a definition that is never used.
+ */
+void Liveness::MarkDeadValues()
+{
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    VarSet live = liveOut[b];
+    std::list<Instruction*>::reverse_iterator p;
+    for (p = b->code.rbegin(); p != b->code.rend(); ++p) {
+      List<Location*> *dead = new List<Location*>;
+      List<Location*> operands;
+      (*p)->GetUses(&operands);
+      if ((*p)->GetDef()) operands.Append((*p)->GetDef());
+      for (int j = 0; j < operands.NumElements(); j++) {
+        int v = Index(operands.Nth(j));
+        if (v >= 0 && !live.Test(v)) dead->Append(operands.Nth(j));
+      }
+      (*p)->SetDeadAfter(dead);
+      Transfer(*p, live);
+    }
+  }
+}
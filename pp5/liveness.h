@@ -0,0 +1,71 @@
+/* File: liveness.h
+ * ----------------
+ * Live variable analysis over a FlowGraph. Only the variables that
+ * live in the stack frame (fp-relative locals, temps and parameters)
+ * are tracked; globals are gp-relative memory that any call can read
+ * or write, so they are never candidates for registers or removal.
+ *
+ * Each tracked variable gets a dense index and sets of variables are
+ * kept as bit vectors. The analysis computes the live-in and live-out
+ * set of every block; clients that need liveness at a particular
+ * instruction walk the block backwards from its live-out set using
+ * Transfer.
+ */
+
+#ifndef _H_liveness
+#define _H_liveness
+
+#include <map>
+#include <vector>
+#include "list.h"
+#include "tac.h"
+
+class FlowGraph;
+class BasicBlock;
+
+class VarSet
+{
+  protected:
+    std::vector<unsigned int> bits;
+
+  public:
+    VarSet(int size = 0) : bits((size + 31) / 32, 0) {}
+
+    bool Test(int i) const  { return (bits[i >> 5] >> (i & 31)) & 1; }
+    void Set(int i)         { bits[i >> 5] |= 1u << (i & 31); }
+    void Clear(int i)       { bits[i >> 5] &= ~(1u << (i & 31)); }
+    bool Union(const VarSet &other); // returns true if this set grew
+    bool operator==(const VarSet &other) const { return bits == other.bits; }
+};
+
+class Liveness
+{
+  protected:
+    FlowGraph *graph;
+    List<Location*> *vars;
+    std::map<Location*, int> index;
+    std::map<BasicBlock*, VarSet> liveIn, liveOut;
+
+    void AddVar(Location *loc);
+
+  public:
+    Liveness(FlowGraph *g);
+
+    int NumVars()                   { return vars->NumElements(); }
+    Location *Var(int i)            { return vars->Nth(i); }
+         // index of a tracked variable, or -1 for NULL/untracked ones
+    int Index(Location *loc);
+
+    const VarSet &LiveIn(BasicBlock *b)  { return liveIn[b]; }
+    const VarSet &LiveOut(BasicBlock *b) { return liveOut[b]; }
+
+         // Updates live (the set live after instr) to the set live
+         // before it: the def is removed and the uses are added.
+    void Transfer(Instruction *instr, VarSet &live);
+
+         // Records on each instruction which of its operands are dead
+         // once it has executed (see Instruction::SetDeadAfter)
+    void MarkDeadValues();
+};
+
+#endif
@@ -18,11 +18,20 @@
  * Specifically, it always loads operands off stacks, and stores the
  * result back.  This breaks bad code immediately, theoretically helping
  * students.
+ *
+ * Values are now kept in registers again. By default the $t registers
+ * act as a cache within each basic block: dirty values are stored at
+ * labels, branches, calls and returns, unless liveness says they are
+ * dead. With -O the register allocator assigns registers across the
+ * whole function instead, and the cache is not used.
  */
 
 #include "mips.h"
 #include <stdarg.h>
 #include <cstring>
+#include <set>
+#include "codegen.h"
+#include "utility.h"
 
 
 
@@ -46,7 +55,7 @@ static bool LocationsAreSame(Location *var1, Location *var2)
 void Mips::SpillRegister(Location *dst, Register reg)
 {
   Assert(dst);
-  const char *offsetFromWhere = dst->GetSegment() == fpRelative? regs[fp].name : regs[gp].name;
+  const char *offsetFromWhere = dst->GetSegment() == fpRelative? regs[frame].name : regs[gp].name;
   Assert(dst->GetOffset() % 4 == 0); // all variables are 4 bytes in size
   Emit("sw %s, %d(%s)\t# spill %s from %s to %s%+d", regs[reg].name,
        dst->GetOffset(), offsetFromWhere, dst->GetName(), regs[reg].name,
@@ -61,7 +70,7 @@ void Mips::SpillRegister(Location *dst, Register reg)
 void Mips::FillRegister(Location *src, Register reg)
 {
   Assert(src);
-  const char *offsetFromWhere = src->GetSegment() == fpRelative? regs[fp].name : regs[gp].name;
+  const char *offsetFromWhere = src->GetSegment() == fpRelative? regs[frame].name : regs[gp].name;
   Assert(src->GetOffset() % 4 == 0); // all variables are 4 bytes in size
   Emit("lw %s, %d(%s)\t# fill %s to %s from %s%+d", regs[reg].name,
        src->GetOffset(), offsetFromWhere, src->GetName(), regs[reg].name,
@@ -69,11 +78,149 @@ void Mips::FillRegister(Location *src, Register reg)
 }
 
 
+/* Method: GetRegister
+ * --------------------
+ * Returns the register holding var for an instruction about to read
+ * or write it. A variable the register allocator placed in a register
+ * is always there; any other variable of such a function is filled
+ * into the given scratch register (if being read) from its slot.
+ * In functions without allocation the register cache is used instead:
+ * if var is already cached (from earlier in the basic block) that
+ * register is reused, otherwise the least recently used general
+ * purpose register is taken over and var filled into it if needed.
+ */
+Mips::Register Mips::GetRegister(Location *var, Reason reason, Register scratch)
+{
+  if (assigned) {
+    std::map<Location*, int>::iterator p = assigned->find(var);
+    if (p != assigned->end()) return (Register)p->second;
+    if (reason == ForRead) FillRegister(var, scratch);
+    return scratch;
+  }
+
+  Register reg = FindRegisterWithContents(var);
+  if (reg == NumRegs) {
+    reg = SelectRegisterToReplace();
+    if (reason == ForRead) FillRegister(var, reg);
+    regs[reg].var = var;
+    regs[reg].isDirty = false;
+  }
+  regs[reg].lastUsed = ++useCount;
+  return reg;
+}
+
+/* Method: CommitRegister
+ * ----------------------
+ * Called after reg, obtained from GetRegister for writing dst, has been
+ * written. Values computed in a scratch register are stored back to
+ * the variable's slot; a cached one is just marked dirty, it will be
+ * stored when the block ends (if it is still live then).
+ */
+void Mips::CommitRegister(Location *dst, Register reg)
+{
+  if (!assigned)
+    regs[reg].isDirty = true;
+  else if (!assigned->count(dst))
+    SpillRegister(dst, reg);
+}
+
+
+/* Method: FindRegisterWithContents
+ * --------------------------------
+ * Returns the register caching var, or NumRegs if it isn't cached.
+ */
+Mips::Register Mips::FindRegisterWithContents(Location *var)
+{
+  for (Register r = t0; r <= t9; r = (Register)(r+1))
+    if (regs[r].var && LocationsAreSame(regs[r].var, var))
+      return r;
+  return NumRegs;
+}
+
+/* Method: SelectRegisterToReplace
+ * -------------------------------
+ * Picks a cache register ($t0-$t9) for a new value: an empty one if
+ * there is one, else the least recently used, which is spilled first
+ * if dirty. The operands of the current instruction were all used more
+ * recently so they are never picked.
+ */
+Mips::Register Mips::SelectRegisterToReplace()
+{
+  Register best = t0;
+  for (Register r = t0; r <= t9; r = (Register)(r+1)) {
+    if (!regs[r].var) return r;
+    if (regs[r].lastUsed < regs[best].lastUsed) best = r;
+  }
+  if (regs[best].isDirty)
+    SpillRegister(regs[best].var, best);
+  regs[best].var = NULL;
+  regs[best].isDirty = false;
+  return best;
+}
+
+bool Mips::IsDeadAfterCurrent(Location *var)
+{
+  List<Location*> *dead = currentInstruction ? currentInstruction->GetDeadAfter() : NULL;
+  for (int i = 0; dead && i < dead->NumElements(); i++)
+    if (dead->Nth(i) == var) return true;
+  return false;
+}
+
+/* Method: SpillDirtyRegisters
+ * ---------------------------
+ * Stores every dirty cached value that is still needed back to its
+ * slot, leaving it cached but clean. Values of stack variables need
+ * not be stored when the frame is about to go away (includeFrame is
+ * false), globals always are.
+ */
+void Mips::SpillDirtyRegisters(bool includeFrame)
+{
+  for (Register r = t0; r <= t9; r = (Register)(r+1)) {
+    Location *var = regs[r].var;
+    if (!var || !regs[r].isDirty || IsDeadAfterCurrent(var)) continue;
+    if (includeFrame || var->GetSegment() == gpRelative)
+      SpillRegister(var, r);
+    regs[r].isDirty = false;
+  }
+}
+
+/* Method: DiscardRegisters
+ * ------------------------
+ * Forgets all cached values, used where the registers may no longer
+ * hold them (a label that other code jumps to, after a call).
+ * Dirty values must have been spilled first.
+ */
+void Mips::DiscardRegisters()
+{
+  for (Register r = t0; r <= t9; r = (Register)(r+1)) {
+    regs[r].var = NULL;
+    regs[r].isDirty = false;
+  }
+}
+
+/* Method: DiscardDeadRegisters
+ * ----------------------------
+ * Called once each instruction has been translated, drops the cached
+ * values that the instruction was the last to need, without spilling.
+ */
+void Mips::DiscardDeadRegisters()
+{
+  if (assigned) return;
+  for (Register r = t0; r <= t9; r = (Register)(r+1)) {
+    if (regs[r].var && IsDeadAfterCurrent(regs[r].var)) {
+      regs[r].var = NULL;
+      regs[r].isDirty = false;
+    }
+  }
+}
+
+
 /* Method: Emit
  * ------------
  * General purpose helper used to emit assembly instructions in
  * a reasonable tidy manner.  Takes printf-style formatting strings
- * and variable arguments.
+ * and variable arguments. The lines are handed to the peephole
+ * optimizer, which prints them when a function is done.
  */
 void Mips::Emit(const char *fmt, ...)
 {
@@ -83,10 +230,7 @@ void Mips::Emit(const char *fmt, ...)
   va_start(args, fmt);
   vsprintf(buf, fmt, args);
   va_end(args);
-  if (buf[strlen(buf) - 1] != ':') printf("\t"); // don't tab in labels
-  if (buf[0] != '#') printf("  ");   // outdent comments a little
-  printf("%s", buf);
-  if (buf[strlen(buf)-1] != '\n') printf("\n"); // end with a newline
+  peephole.Add(buf);
 }
 
 
@@ -99,28 +243,57 @@ void Mips::Emit(const char *fmt, ...)
  */
 void Mips::EmitLoadConstant(Location *dst, int val)
 {
-  Register r = rd; 
+  Register r = GetRegister(dst, ForWrite, rd);
   Emit("li %s, %d\t\t# load constant value %d into %s", regs[r].name,
 	 val, val, regs[r].name);
-  SpillRegister(dst, rd);
+  CommitRegister(dst, r);
 }
 
 /* Method: EmitLoadStringConstant
  * ------------------------------
- * Used to assign a variable a pointer to string constant. Emits
- * assembly directives to create a new null-terminated string in the
- * data segment and assigns it a unique label. Slaves dst into a register
- * and loads that label address into the register.
+ * Used to assign a variable a pointer to string constant. The first
+ * use of a string gives it a unique label in the string pool (see
+ * EmitStringPool), later uses of the same string share it. Slaves dst
+ * into a register and loads that label address into the register.
  */
 void Mips::EmitLoadStringConstant(Location *dst, const char *str)
 {
-  static int strNum = 1;
-  char label[16];
-  sprintf(label, "_string%d", strNum++);
-  Emit(".data\t\t\t# create string constant marked with label");
-  Emit("%s: .asciiz %s", label, str);
+  if (!stringLabels.count(str)) {
+    char label[32];
+    sprintf(label, "_string%d", (int)strings.size() + 1);
+    stringLabels[str] = label;
+    strings.push_back(str);
+  }
+  EmitLoadLabel(dst, stringLabels[str].c_str());
+}
+
+// The string as written is in quotes, and SPIM reads an escape like
+// \n as one character.
+int Mips::StringLength(const char *str)
+{
+  int length = 0;
+  for (const char *c = str + 1; *c && *c != '"'; c++, length++)
+    if (*c == '\\' && c[1]) c++;
+  return length;
+}
+
+/* Method: EmitStringPool
+ * ----------------------
+ * Lays out the string constants in one data section after the code.
+ * The word before each string holds its length, so the runtime can
+ * know it without looking for the terminating null.
+ */
+void Mips::EmitStringPool()
+{
+  if (strings.empty()) return;
+  Emit(".data\t\t\t# string constants, each preceded by its length");
+  for (size_t i = 0; i < strings.size(); i++) {
+    const char *str = strings[i].c_str();
+    Emit(".align 2");
+    Emit(".word %d", StringLength(str));
+    Emit("%s: .asciiz %s", stringLabels[strings[i]].c_str(), str);
+  }
   Emit(".text");
-  EmitLoadLabel(dst, label);
 }
 
 
@@ -131,8 +304,9 @@ void Mips::EmitLoadStringConstant(Location *dst, const char *str)
  */
 void Mips::EmitLoadLabel(Location *dst, const char *label)
 {
-  Emit("la %s, %s\t# load label", regs[rd].name, label);
-  SpillRegister(dst, rd);
+  Register r = GetRegister(dst, ForWrite, rd);
+  Emit("la %s, %s\t# load label", regs[r].name, label);
+  CommitRegister(dst, r);
 }
  
 
@@ -144,8 +318,12 @@ void Mips::EmitLoadLabel(Location *dst, const char *label)
  */
 void Mips::EmitCopy(Location *dst, Location *src)
 {
-  FillRegister(src, rd);
-  SpillRegister(dst, rd);
+  Register s = GetRegister(src, ForRead, rd);
+  Register d = GetRegister(dst, ForWrite, rd);
+  if (d != s)
+    Emit("move %s, %s\t\t# copy %s to %s", regs[d].name, regs[s].name,
+	 src->GetName(), dst->GetName());
+  CommitRegister(dst, d);
 }
 
 
@@ -159,10 +337,11 @@ void Mips::EmitCopy(Location *dst, Location *src)
  */
 void Mips::EmitLoad(Location *dst, Location *reference, int offset)
 {
-  FillRegister(reference, rs);
-  Emit("lw %s, %d(%s) \t# load with offset", regs[rd].name,
-	 offset, regs[rs].name);
-  SpillRegister(dst, rd);
+  Register r = GetRegister(reference, ForRead, rs);
+  Register d = GetRegister(dst, ForWrite, rd);
+  Emit("lw %s, %d(%s) \t# load with offset", regs[d].name,
+	 offset, regs[r].name);
+  CommitRegister(dst, d);
 }
 
 
@@ -176,10 +355,10 @@ void Mips::EmitLoad(Location *dst, Location *reference, int offset)
  */
 void Mips::EmitStore(Location *reference, Location *value, int offset)
 {
-  FillRegister(value, rs);
-  FillRegister(reference, rd);
+  Register v = GetRegister(value, ForRead, rs);
+  Register r = GetRegister(reference, ForRead, rd);
   Emit("sw %s, %d(%s) \t# store with offset",
-	 regs[rs].name, offset, regs[rd].name);
+	 regs[v].name, offset, regs[r].name);
 }
 
 
@@ -194,11 +373,12 @@ void Mips::EmitStore(Location *reference, Location *value, int offset)
 void Mips::EmitBinaryOp(BinaryOp::OpCode code, Location *dst, 
 				 Location *op1, Location *op2)
 {
-  FillRegister(op1, rs);
-  FillRegister(op2, rt);
-  Emit("%s %s, %s, %s\t", NameForTac(code), regs[rd].name,
-	 regs[rs].name, regs[rt].name);
-  SpillRegister(dst, rd);
+  Register r1 = GetRegister(op1, ForRead, rs);
+  Register r2 = GetRegister(op2, ForRead, rt);
+  Register d = GetRegister(dst, ForWrite, rd);
+  Emit("%s %s, %s, %s\t", NameForTac(code), regs[d].name,
+	 regs[r1].name, regs[r2].name);
+  CommitRegister(dst, d);
 }
 
 
@@ -211,7 +391,8 @@ void Mips::EmitBinaryOp(BinaryOp::OpCode code, Location *dst,
  */
 void Mips::EmitLabel(const char *label)
 {
- 
+  SpillDirtyRegisters(true);
+  DiscardRegisters();
   Emit("%s:", label);
 }
 
@@ -225,7 +406,8 @@ void Mips::EmitLabel(const char *label)
  */
 void Mips::EmitGoto(const char *label)
 {
- 
+  SpillDirtyRegisters(true);
+  DiscardRegisters();
   Emit("b %s\t\t# unconditional branch", label);
 }
 
@@ -239,24 +421,60 @@ void Mips::EmitGoto(const char *label)
  */
 void Mips::EmitIfZ(Location *test, const char *label)
 {
-  FillRegister(test, rs);
-  Emit("beqz %s, %s\t# branch if %s is zero ", regs[rs].name, label,
+  Register r = GetRegister(test, ForRead, rs);
+  SpillDirtyRegisters(true);
+  Emit("beqz %s, %s\t# branch if %s is zero ", regs[r].name, label,
 	 test->GetName());
 }
 
 
+/* Method: EmitIfCompare
+ * ---------------------
+ * Used for a branch on the comparison of two variables, which saves
+ * computing the comparison into a register and testing that. Both
+ * operands are slaved to registers and all registers are spilled
+ * before the branch, like for IfZ.
+ */
+void Mips::EmitIfCompare(IfCompare::Relation relation, Location *op1,
+			 Location *op2, const char *label)
+{
+  static const char *branch[IfCompare::NumRelations] =
+    {"blt", "ble", "bgt", "bge", "beq", "bne"};
+  Register r1 = GetRegister(op1, ForRead, rs);
+  Register r2 = GetRegister(op2, ForRead, rt);
+  SpillDirtyRegisters(true);
+  Emit("%s %s, %s, %s\t# branch if %s %s %s", branch[relation], regs[r1].name,
+	 regs[r2].name, label, op1->GetName(), IfCompare::relationName[relation],
+	 op2->GetName());
+}
+
+
 /* Method: EmitParam
  * -----------------
  * Used to push a parameter on the stack in anticipation of upcoming
  * function call. Decrements the stack pointer by 4. Slaves argument into
  * register and then stores contents to location just made at end of
  * stack.
+ * Under the register calling convention the first push of a call
+ * (its last argument) makes room for all of them at once, and the
+ * first four arguments go in $a0-$a3 rather than their slots. The
+ * callee stores them there if it needs them in memory.
  */
-void Mips::EmitParam(Location *arg)
+void Mips::EmitParam(Location *arg, int index, int count)
 { 
-  Emit("subu $sp, $sp, 4\t# decrement sp to make space for param");
-  FillRegister(arg, rs);
-  Emit("sw %s, 4($sp)\t# copy param value to stack", regs[rs].name);
+  if (!registerArgs || index < 0) {
+    Emit("subu $sp, $sp, 4\t# decrement sp to make space for param");
+    Register r = GetRegister(arg, ForRead, rs);
+    Emit("sw %s, 4($sp)\t# copy param value to stack", regs[r].name);
+    return;
+  }
+  if (index == count - 1)
+    Emit("subu $sp, $sp, %d\t# decrement sp to make space for params", 4 * count);
+  Register r = GetRegister(arg, ForRead, rs);
+  if (index < NumRegisterArgs)
+    Emit("move %s, %s\t\t# pass param in register", regs[a0 + index].name, regs[r].name);
+  else
+    Emit("sw %s, %d($sp)\t# copy param value to stack", regs[r].name, 4 + 4 * index);
 }
 
 
@@ -273,16 +491,41 @@ void Mips::EmitParam(Location *arg)
  */
 void Mips::EmitCallInstr(Location *result, const char *fn, bool isLabel)
 {
+  SpillDirtyRegisters(true);
+  DiscardRegisters();
+  if (isLabel && registerArgs)
+    fn = BuiltInEntry(fn);
   Emit("%s %-15s\t# jump to function", isLabel? "jal": "jalr", fn);
+  List<Location*> *roots = currentInstruction ? currentInstruction->GetRoots() : NULL;
+  if (roots) {
+    const char *label = CodeGenerator::NewLabel();
+    Emit("%s:\t\t\t# return address with a stack map", label);
+    RecordStackMap(label, roots);
+  }
   if (result != NULL) {
+    Register r = GetRegister(result, ForWrite, rd);
     Emit("move %s, %s\t\t# copy function return value from $v0",
-    regs[rd].name, regs[v0].name);
-    SpillRegister(result, rd);
+    regs[r].name, regs[v0].name);
+    CommitRegister(result, r);
   }
 }
 
 
 // Two covers for the above method for specific LCall/ACall variants
+// The built-ins that take arguments have a second entry point in
+// defs.asm that expects them in registers.
+const char *Mips::BuiltInEntry(const char *label)
+{
+  static const char *entries[][2] = {
+    {"_Alloc", "__Alloc"}, {"_StringEqual", "__StringEqual"},
+    {"_StringEqualLiteral", "__StringEqualLiteral"},
+    {"_PrintInt", "__PrintInt"}, {"_PrintString", "__PrintString"},
+    {"_PrintBool", "__PrintBool"}, {NULL, NULL}};
+  for (int i = 0; entries[i][0]; i++)
+    if (!strcmp(label, entries[i][0])) return entries[i][1];
+  return label;
+}
+
 void Mips::EmitLCall(Location *dst, const char *label)
 { 
   EmitCallInstr(dst, label, true);
@@ -290,8 +533,8 @@ void Mips::EmitLCall(Location *dst, const char *label)
 
 void Mips::EmitACall(Location *dst, Location *fn)
 {
-  FillRegister(fn, rs);
-  EmitCallInstr(dst, regs[rs].name, false);
+  Register r = GetRegister(fn, ForRead, rs);
+  EmitCallInstr(dst, regs[r].name, false);
 }
 
 /*
@@ -317,21 +560,60 @@ void Mips::EmitPopParams(int bytes)
  * do the last part of the callee's job in function call protocol,
  * which is to remove our locals/temps from the stack, remove
  * saved registers ($fp and $ra) and restore previous values of
- * $fp and $ra so everything is returned to the state we entered.
- * We then emit jr to jump to the saved $ra.
+ * $fp and $ra (and any callee-saved registers we used) so everything
+ * is returned to the state we entered.
+ * We then emit jr to jump to the saved $ra. $ra is only restored if
+ * it was saved on the way here (see shrinkwrap.h).
  */
- void Mips::EmitReturn(Location *returnVal)
+ void Mips::EmitReturn(Location *returnVal, bool restoreRA)
 { 
   if (returnVal != NULL) 
     {
-      FillRegister(returnVal, rd);
+      Register r = GetRegister(returnVal, ForRead, rd);
       Emit("move $v0, %s\t\t# assign return value into $v0",
-	   regs[rd].name);
+	   regs[r].name);
     }
+  SpillDirtyRegisters(false);
+  DiscardRegisters();
+  EmitPopFrame(restoreRA);
+  Emit("jr $ra\t\t# return from function");
+}
+
+// Restores the callee-saved registers, $ra and $fp of our caller and
+// pops our frame, the last step before leaving the function. There
+// is nothing to pop without a frame.
+void Mips::EmitPopFrame(bool restoreRA)
+{
+  if (frame == sp) return;
+  for (int i = 0; i < savedRegs->NumElements(); i++)
+    Emit("lw %s, %d($fp)\t# restore callee-saved %s", regs[savedRegs->Nth(i)].name,
+	 savedOffset - 4*i, regs[savedRegs->Nth(i)].name);
   Emit("move $sp, $fp\t\t# pop callee frame off stack");
-  Emit("lw $ra, -4($fp)\t# restore saved ra");
+  if (restoreRA)
+    Emit("lw $ra, -4($fp)\t# restore saved ra");
   Emit("lw $fp, 0($fp)\t# restore saved fp");
-  Emit("jr $ra\t\t# return from function");
+}
+
+/* Method: EmitTailCall
+ * --------------------
+ * A call that is the last thing a function does. The arguments just
+ * pushed are copied over our own parameters (there is room, see
+ * tailcall.h), our frame is popped as for a return, and we jump to
+ * the callee rather than jal, so it finds our caller's $ra and $fp
+ * and returns straight to it.
+ */
+void Mips::EmitTailCall(const char *label, int bytes, bool restoreRA)
+{
+  SpillDirtyRegisters(false);
+  DiscardRegisters();
+  int first = registerArgs ? 4 + 4 * NumRegisterArgs : 4;
+  for (int off = first; off <= bytes; off += 4) {
+    Emit("lw $v0, %d($sp)\t# move param into our caller's pushes", off);
+    Emit("sw $v0, %d($fp)", off);
+  }
+  EmitPopFrame(restoreRA);
+  Emit("j %-15s\t# tail call, returns to our caller",
+       registerArgs ? BuiltInEntry(label) : label);
 }
 
 
@@ -342,18 +624,71 @@ void Mips::EmitPopParams(int bytes)
  * and then save the current values of $fp and $ra (since we are
  * going to change them), then set up the $fp and bump the $sp down
  * to make space for all our locals/temps.
+ * When the register allocator has run, the callee-saved registers it
+ * handed out are saved in extra slots below the locals, and the
+ * parameters kept in registers are loaded from the caller's pushes.
+ * $ra is left for SaveRA to save where the function doesn't save it
+ * up front. A leaf with nothing in its frame doesn't set one up at
+ * all: $sp stays where the caller left it, so the parameters are
+ * found from it instead of $fp.
  */
-void Mips::EmitBeginFunction(int stackFrameSize)
+void Mips::EmitBeginFunction(int stackFrameSize, std::map<Location*, int> *registers,
+                             bool saveRA, bool isLeaf, int numParams)
 {
   Assert(stackFrameSize >= 0);
-  Emit("subu $sp, $sp, 8\t# decrement sp to make space to save ra, fp");
-  Emit("sw $fp, 8($sp)\t# save fp");
-  Emit("sw $ra, 4($sp)\t# save ra");
-  Emit("addiu $fp, $sp, 8\t# set up new fp");
+  DiscardRegisters();
+  assigned = registers;
+  savedRegs = new List<Register>;
+  savedOffset = CodeGenerator::OffsetToFirstLocal - stackFrameSize;
+  std::map<Location*, int>::iterator p;
+  if (assigned) {
+    for (Register r = s0; r <= s7; r = (Register)(r + 1))
+      for (p = assigned->begin(); p != assigned->end(); ++p)
+        if (p->second == r) {
+          savedRegs->Append(r);
+          break;
+        }
+    stackFrameSize += 4 * savedRegs->NumElements();
+  }
+
+  frame = (isLeaf && stackFrameSize == 0) ? sp : fp;
+  if (frame == fp) {
+    Emit("subu $sp, $sp, 8\t# decrement sp to make space to save ra, fp");
+    Emit("sw $fp, 8($sp)\t# save fp");
+    if (saveRA)
+      Emit("sw $ra, 4($sp)\t# save ra");
+    Emit("addiu $fp, $sp, 8\t# set up new fp");
+  }
 
   if (stackFrameSize != 0)
     Emit("subu $sp, $sp, %d\t# decrement sp to make space for locals/temps",
 	   stackFrameSize);
+
+  for (int i = 0; i < savedRegs->NumElements(); i++)
+    Emit("sw %s, %d($fp)\t# save callee-saved %s", regs[savedRegs->Nth(i)].name,
+	 savedOffset - 4*i, regs[savedRegs->Nth(i)].name);
+  std::set<int> moved;        // offsets of the params passed in $a0-$a3
+  if (assigned) {
+    for (p = assigned->begin(); p != assigned->end(); ++p) {
+      if (p->first->GetSegment() != fpRelative || p->first->GetOffset() <= 0) continue;
+      int k = (p->first->GetOffset() - CodeGenerator::OffsetToFirstParam) / 4;
+      if (registerArgs && k < NumRegisterArgs) {
+        Emit("move %s, %s\t\t# param %s passed in register", regs[p->second].name,
+	     regs[a0 + k].name, p->first->GetName());
+        moved.insert(p->first->GetOffset());
+      } else {
+        Emit("lw %s, %d(%s)\t# load param %s into %s", regs[p->second].name,
+	     p->first->GetOffset(), regs[frame].name, p->first->GetName(),
+	     regs[p->second].name);
+      }
+    }
+  }
+  for (int k = 0; registerArgs && k < numParams && k < NumRegisterArgs; k++) {
+    int offset = CodeGenerator::OffsetToFirstParam + 4 * k;
+    if (!moved.count(offset))
+      Emit("sw %s, %d(%s)\t# store param passed in register", regs[a0 + k].name,
+	   offset, regs[frame].name);
+  }
 }
 
 
@@ -363,10 +698,34 @@ void Mips::EmitBeginFunction(int stackFrameSize)
  * case to clean up stack frame, return to caller etc. See comments on
  * EmitReturn above.
  */
-void Mips::EmitEndFunction()
+void Mips::EmitEndFunction(bool restoreRA)
 { 
   Emit("# (below handles reaching end of fn body with no explicit return)");
-  EmitReturn(NULL);
+  EmitReturn(NULL, restoreRA);
+  assigned = NULL;
+  peephole.Flush();
+}
+
+void Mips::EmitSaveRA()
+{
+  Emit("sw $ra, -4($fp)\t# save ra, a call follows");
+}
+
+/* Method: EmitStackBlock
+ * ----------------------
+ * Clears the words of a block in the frame, writes its header where
+ * the collector looks for it and sets dst to the word after.
+ */
+void Mips::EmitStackBlock(Location *dst, int offset, int bytes, int header)
+{
+  Assert(frame == fp);
+  for (int i = 4; i < bytes; i += 4)
+    Emit("sw $zero, %d($fp)\t# clear stack block", offset + i);
+  Register r = GetRegister(dst, ForWrite, rd);
+  Emit("li %s, %d\t\t# header of stack block", regs[r].name, header);
+  Emit("sw %s, %d($fp)", regs[r].name, offset);
+  Emit("addiu %s, $fp, %d\t# address of stack block", regs[r].name, offset + 4);
+  CommitRegister(dst, r);
 }
 
 
@@ -375,12 +734,19 @@ void Mips::EmitEndFunction()
  * ------------------
  * Used to layout a vtable. Uses assembly directives to set up new
  * entry in data segment, emits label, and lays out the function
- * labels one after another.
+ * labels one after another. The words before the label are the pointer
+ * map of the class for the collector: the number of pointer fields
+ * right before it, and before that each field's offset plus its
+ * PointerKind, going backwards.
  */
-void Mips::EmitVTable(const char *label, List<const char*> *methodLabels)
+void Mips::EmitVTable(const char *label, List<const char*> *methodLabels,
+                      List<int> *pointerFields)
 {
   Emit(".data");
   Emit(".align 2");
+  for (int i = pointerFields->NumElements() - 1; i >= 0; i--)
+    Emit(".word %d\t\t# pointer field", pointerFields->Nth(i));
+  Emit(".word %d\t\t# number of pointer fields", pointerFields->NumElements());
   Emit("%s:\t\t# label for class %s vtable", label, label);
   for (int i = 0; i < methodLabels->NumElements(); i++)
     Emit(".word %s\n", methodLabels->Nth(i));
@@ -388,6 +754,72 @@ void Mips::EmitVTable(const char *label, List<const char*> *methodLabels)
 }
 
 
+/* Method: RecordStackMap
+ * ----------------------
+ * Describes the frame at the call that returns to label. A stack map
+ * is the return address, the number of frame slots, registers and
+ * saved registers it lists, then the slots (offset from $fp plus the
+ * PointerKind), the registers (the number of the $s register times 4
+ * plus the PointerKind) and the callee-saved registers of the caller
+ * this function saved in its frame (the number of the $s register and
+ * the offset, a pair of words each). The collector needs those to
+ * find the registers of the frames further out.
+ */
+void Mips::RecordStackMap(const char *label, List<Location*> *roots)
+{
+  List<int> slots, inRegisters;
+  for (int i = 0; i < roots->NumElements(); i++) {
+    Location *var = roots->Nth(i);
+    std::map<Location*, int>::iterator p;
+    if (assigned && (p = assigned->find(var)) != assigned->end()) {
+      Assert(p->second >= s0 && p->second <= s7); // live across a call
+      inRegisters.Append(4 * (p->second - s0) + var->GetPointer());
+    } else {
+      Assert(var->GetSegment() == fpRelative && frame == fp);
+      slots.Append(var->GetOffset() + var->GetPointer());
+    }
+  }
+  char line[64];
+  sprintf(line, ".word %s, %d, %d, %d", label, slots.NumElements(),
+          inRegisters.NumElements(), savedRegs->NumElements());
+  stackMaps.push_back(line);
+  for (int i = 0; i < slots.NumElements(); i++) {
+    sprintf(line, ".word %d", slots.Nth(i));
+    stackMaps.push_back(line);
+  }
+  for (int i = 0; i < inRegisters.NumElements(); i++) {
+    sprintf(line, ".word %d", inRegisters.Nth(i));
+    stackMaps.push_back(line);
+  }
+  for (int i = 0; i < savedRegs->NumElements(); i++) {
+    sprintf(line, ".word %d, %d", savedRegs->Nth(i) - s0, savedOffset - 4*i);
+    stackMaps.push_back(line);
+  }
+}
+
+/* Method: EmitRootMaps
+ * --------------------
+ * Lays out where the collector starts looking for live objects: the
+ * globals that hold pointers (their number, then each offset from $gp
+ * plus its PointerKind) and the stack maps of all calls, ended by a 0.
+ */
+void Mips::EmitRootMaps(List<Location*> *globals)
+{
+  Emit(".data");
+  Emit(".align 2");
+  Emit("__GlobalRoots:");
+  Emit(".word %d", globals->NumElements());
+  for (int i = 0; i < globals->NumElements(); i++)
+    Emit(".word %d\t\t# %s", globals->Nth(i)->GetOffset() + globals->Nth(i)->GetPointer(),
+         globals->Nth(i)->GetName());
+  Emit("__StackMaps:");
+  for (size_t i = 0; i < stackMaps.size(); i++)
+    Emit("%s", stackMaps[i].c_str());
+  Emit(".word 0");
+  Emit(".text");
+}
+
+
 /* Method: EmitPreamble
  * --------------------
  * Used to emit the starting sequence needed for a program. Not much
@@ -432,6 +864,7 @@ Mips::Mips() {
   mipsName[BinaryOp::Less] = "slt";
   mipsName[BinaryOp::And] = "and";
   mipsName[BinaryOp::Or] = "or";
+  mipsName[BinaryOp::ShiftLeft] = "sllv";
   regs[zero] = (RegContents){false, NULL, "$zero", false};
   regs[at] = (RegContents){false, NULL, "$at", false};
   regs[v0] = (RegContents){false, NULL, "$v0", false};
@@ -465,8 +898,26 @@ Mips::Mips() {
   regs[s6] = (RegContents){false, NULL, "$s6", true};
   regs[s7] = (RegContents){false, NULL, "$s7", true};
   rs = t0; rt = t1; rd = t2;
+  useCount = 0;
+  assigned = NULL;
+  savedRegs = new List<Register>;
+  frame = fp;
+  registerArgs = GetOptimizationLevel() > 0;
+}
 
+/* Destructor
+ * ----------
+ * Prints whatever is still buffered (the vtables come after the last
+ * function) with the string pool, and reports what the peephole
+ * optimizer did.
+ */
+Mips::~Mips() {
+  EmitStringPool();
+  peephole.Flush();
+  Peephole::Report();
 }
+
 const char *Mips::mipsName[BinaryOp::NumOps];
+Peephole Mips::peephole;
 
 
@@ -18,45 +18,97 @@
 #ifndef _H_mips
 #define _H_mips
 
+#include <map>
+#include <string>
+#include <vector>
 #include "tac.h"
 #include "list.h"
+#include "peephole.h"
 class Location;
 
 
 class Mips {
-  private:
+  public:
     typedef enum {zero, at, v0, v1, a0, a1, a2, a3,
 			s0, s1, s2, s3, s4, s5, s6, s7,
 			t0, t1, t2, t3, t4, t5, t6, t7,
 			t8, t9, k0, k1, gp, sp, fp, ra, NumRegs } Register;
 
+  private:
     struct RegContents {
 	bool isDirty;
 	Location *var;
 	const char *name;
 	bool isGeneralPurpose;
+	int lastUsed;       // for picking the least recently used to replace
     } regs[NumRegs];
+    int useCount;
 
     Register rs, rt, rd;
 
     typedef enum { ForRead, ForWrite } Reason;
+
+         // registers given to variables of the current function by
+         // the register allocator (NULL when not optimizing), and the
+         // callee-saved ones among them that the prologue saves
+    std::map<Location*, int> *assigned;
+    List<Register> *savedRegs;
+    int savedOffset;
+
+         // the register stack variables are addressed from: $fp, or $sp
+         // in a leaf that needs no frame (see EmitBeginFunction)
+    Register frame;
+
+         // -O passes this and the first arguments in $a0-$a3
+    bool registerArgs;
+    static const int NumRegisterArgs = 4;
     
     void FillRegister(Location *src, Register reg);
     void SpillRegister(Location *dst, Register reg);
+    Register GetRegister(Location *var, Reason reason, Register scratch);
+    void CommitRegister(Location *dst, Register reg);
+
+         // the register cache used for functions without allocation
+    Register FindRegisterWithContents(Location *var);
+    Register SelectRegisterToReplace();
+    bool IsDeadAfterCurrent(Location *var);
+    void SpillDirtyRegisters(bool includeFrame);
+    void DiscardRegisters();
+    void DiscardDeadRegisters();
 
     void EmitCallInstr(Location *dst, const char *fn, bool isL);
+    static const char *BuiltInEntry(const char *label);
+    void EmitPopFrame(bool restoreRA);
     
     static const char *mipsName[BinaryOp::NumOps];
     static const char *NameForTac(BinaryOp::OpCode code);
 
     Instruction* currentInstruction;
+
+         // everything emitted is buffered here and optimized a
+         // function at a time
+    static Peephole peephole;
+
+         // the string constants of the program, each emitted once
+         // (with the label it was given) after all the code
+    std::map<std::string, std::string> stringLabels;
+    std::vector<std::string> strings;
+    void EmitStringPool();
+
+         // the stack maps of the calls emitted so far, as lines of
+         // data (see EmitRootMaps)
+    std::vector<std::string> stackMaps;
+    void RecordStackMap(const char *label, List<Location*> *roots);
  public:
     Mips();
+    ~Mips();
 
     static void Emit(const char *fmt, ...);
     
     void EmitLoadConstant(Location *dst, int val);
     void EmitLoadStringConstant(Location *dst, const char *str);
+         // characters in a string constant as written in the source
+    static int StringLength(const char *str);
     void EmitLoadLabel(Location *dst, const char *label);
 
     void EmitLoad(Location *dst, Location *reference, int offset);
@@ -69,17 +121,25 @@ class Mips {
     void EmitLabel(const char *label);
     void EmitGoto(const char *label);
     void EmitIfZ(Location *test, const char*label);
-    void EmitReturn(Location *returnVal);
+    void EmitIfCompare(IfCompare::Relation relation, Location *op1,
+		       Location *op2, const char *label);
+    void EmitReturn(Location *returnVal, bool restoreRA = true);
 
-    void EmitBeginFunction(int frameSize);
-    void EmitEndFunction();
+    void EmitBeginFunction(int frameSize, std::map<Location*, int> *registers = NULL,
+                           bool saveRA = true, bool isLeaf = false, int numParams = 0);
+    void EmitEndFunction(bool restoreRA = true);
+    void EmitSaveRA();
+    void EmitStackBlock(Location *dst, int offset, int bytes, int header);
 
-    void EmitParam(Location *arg);
+    void EmitParam(Location *arg, int index = -1, int count = -1);
     void EmitLCall(Location *result, const char* label);
     void EmitACall(Location *result, Location *fnAddr);
     void EmitPopParams(int bytes);
+    void EmitTailCall(const char *label, int bytes, bool restoreRA = true);
 
-    void EmitVTable(const char *label, List<const char*> *methodLabels);
+    void EmitVTable(const char *label, List<const char*> *methodLabels,
+                    List<int> *pointerFields);
+    void EmitRootMaps(List<Location*> *globals);
 
     void EmitPreamble();
 
@@ -100,6 +160,7 @@ public:
 
   ~CurrentInstruction()
   {
+    mips.DiscardDeadRegisters();
     mips.currentInstruction= NULL;
   }
 
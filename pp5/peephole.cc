@@ -0,0 +1,470 @@
+/* File: peephole.cc
+ * -----------------
+ * Implementation of the peephole optimizer over the MIPS assembly.
+ */
+
+#include "peephole.h"
+#include "utility.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+Peephole::Rule Peephole::rules[] = {
+  {"self-move",    &Peephole::SelfMove,       0},
+  {"store-load",   &Peephole::StoreLoad,      0},
+  {"load-load",    &Peephole::LoadLoad,       0},
+  {"branch-next",  &Peephole::BranchToNext,   0},
+  {"branch-over",  &Peephole::BranchOver,     0},
+  {"compare-zero", &Peephole::CompareZero,    0},
+  {"immediate",    &Peephole::Immediate,      0},
+  {"dead-def",     &Peephole::DeadDefinition, 0},
+  {"unreachable",  &Peephole::Unreachable,    0},
+  {NULL,           NULL,                      0}
+};
+
+// in the order of Mips::Register
+static const char *registerNames[] = {
+  "$zero", "$at", "$v0", "$v1", "$a0", "$a1", "$a2", "$a3",
+  "$s0", "$s1", "$s2", "$s3", "$s4", "$s5", "$s6", "$s7",
+  "$t0", "$t1", "$t2", "$t3", "$t4", "$t5", "$t6", "$t7",
+  "$t8", "$t9", "$k0", "$k1", "$gp", "$sp", "$fp", "$ra"
+};
+static const int NumRegisters = 32;
+
+static unsigned Bit(int reg) { return reg < 0 ? 0 : 1u << reg; }
+
+static std::string Trim(const std::string &s)
+{
+  size_t first = s.find_first_not_of(" \t\n");
+  if (first == std::string::npos) return "";
+  return s.substr(first, s.find_last_not_of(" \t\n") - first + 1);
+}
+
+static std::string Number(int value)
+{
+  char buf[16];
+  sprintf(buf, "%d", value);
+  return buf;
+}
+
+static bool IsNumber(const std::string &s, int *value)
+{
+  char *end;
+  if (s.empty()) return false;
+  long v = strtol(s.c_str(), &end, 10);
+  *value = (int)v;
+  return *end == '\0';
+}
+
+
+/* Method: Add
+ * -----------
+ * Splits a line into its opcode, operands and comment. Labels are
+ * remembered so branches can find them; anything in the data segment
+ * is kept as is.
+ */
+void Peephole::Add(const char *text)
+{
+  Line l;
+  l.text = text;
+  l.deleted = false;
+  if (text[0] == '#') {
+    l.kind = Comment;
+  } else if (text[0] == '.') {
+    l.kind = Other;
+    if (!strncmp(text, ".data", 5)) inData = true;
+    if (!strncmp(text, ".text", 5)) inData = false;
+  } else if (inData) {
+    l.kind = Other;
+  } else {
+    std::string s = l.text;
+    size_t hash = s.find('#');
+    if (hash != std::string::npos) {
+      l.comment = Trim(s.substr(hash + 1));
+      s = s.substr(0, hash);
+    }
+    s = Trim(s);
+    size_t space = s.find_first_of(" \t");
+    l.op = s.substr(0, space);
+    if (!l.op.empty() && l.op[l.op.size() - 1] == ':') {
+      l.kind = CodeLabel;
+      l.op = l.op.substr(0, l.op.size() - 1);
+      labels[l.op] = lines.size();
+    } else {
+      l.kind = Instr;
+      std::string rest = space == std::string::npos ? "" : s.substr(space);
+      while (!Trim(rest).empty()) {
+        size_t comma = rest.find(',');
+        l.args.push_back(Trim(rest.substr(0, comma)));
+        rest = comma == std::string::npos ? "" : rest.substr(comma + 1);
+      }
+    }
+  }
+  lines.push_back(l);
+}
+
+/* Method: Flush
+ * -------------
+ * Applies the rules at every instruction until none fires, then
+ * prints what is left the way Mips::Emit used to.
+ */
+void Peephole::Flush()
+{
+  bool changed = true;
+  for (int pass = 0; changed && pass < 10; pass++) {
+    changed = false;
+    ComputeLiveness();
+    for (int i = 0; i < (int)lines.size(); i++) {
+      for (int r = 0; rules[r].name; r++) {
+        if (lines[i].deleted || lines[i].kind != Instr) break;
+        if ((this->*rules[r].apply)(i)) {
+          rules[r].hits++;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  for (int i = 0; i < (int)lines.size(); i++) {
+    if (lines[i].deleted) continue;
+    const char *buf = lines[i].text.c_str();
+    if (buf[strlen(buf) - 1] != ':') printf("\t"); // don't tab in labels
+    if (buf[0] != '#') printf("  ");   // outdent comments a little
+    printf("%s", buf);
+    if (buf[strlen(buf)-1] != '\n') printf("\n"); // end with a newline
+  }
+  lines.clear();
+  labels.clear();
+}
+
+void Peephole::Report()
+{
+  for (int r = 0; rules[r].name; r++)
+    PrintDebug("peephole", "%s: %d", rules[r].name, rules[r].hits);
+}
+
+
+int Peephole::RegisterNumber(const std::string &name)
+{
+  for (int r = 0; r < NumRegisters; r++)
+    if (name == registerNames[r]) return r;
+  return -1;
+}
+
+// the register an operand like -12($fp) is relative to
+int Peephole::BaseRegister(const std::string &address)
+{
+  size_t open = address.find('(');
+  if (open == std::string::npos) return -1;
+  return RegisterNumber(address.substr(open + 1, address.find(')') - open - 1));
+}
+
+bool Peephole::IsBranch(const std::string &op)
+{
+  static const char *branches[] = {"b", "j", "beq", "bne", "blt", "ble", "bgt", "bge",
+                                   "beqz", "bnez", "bltz", "blez", "bgtz", "bgez", NULL};
+  for (int i = 0; branches[i]; i++)
+    if (op == branches[i]) return true;
+  return false;
+}
+
+const char *Peephole::Target(const Line &l)
+{
+  if (l.kind != Instr || !IsBranch(l.op) || l.args.empty()) return NULL;
+  return l.args.back().c_str();
+}
+
+/* Methods: Uses, Defs
+ * -------------------
+ * The registers an instruction reads and writes. A call reads the
+ * argument registers and the frame, and returns in $v0; jr leaves the
+ * function, so everything counts as read there.
+ */
+unsigned Peephole::Uses(const Line &l)
+{
+  if (l.kind != Instr) return 0;
+  if (l.op == "jr") return ~0u;
+  unsigned args = Bit(4) | Bit(5) | Bit(6) | Bit(7);
+  unsigned frame = Bit(RegisterNumber("$gp")) | Bit(RegisterNumber("$sp"))
+                 | Bit(RegisterNumber("$fp"));
+  if (l.op == "jal") return args | frame;
+  if (l.op == "jalr") return args | frame | Bit(RegisterNumber(l.args[0]));
+
+  unsigned used = 0;
+  size_t first = 1;
+  if (l.op == "sw" || IsBranch(l.op)) first = 0;
+  if (l.op == "li" || l.op == "la") return 0;
+  for (size_t a = first; a < l.args.size(); a++)
+    used |= Bit(RegisterNumber(l.args[a])) | Bit(BaseRegister(l.args[a]));
+  return used;
+}
+
+unsigned Peephole::Defs(const Line &l)
+{
+  if (l.kind != Instr || l.op == "sw" || IsBranch(l.op) || l.op == "jr") return 0;
+  if (l.op == "jal" || l.op == "jalr")
+    return Bit(RegisterNumber("$v0")) | Bit(RegisterNumber("$v1")) | Bit(RegisterNumber("$ra"));
+  return l.args.empty() ? 0 : Bit(RegisterNumber(l.args[0]));
+}
+
+/* Method: ComputeLiveness
+ * -----------------------
+ * Backward dataflow over the buffered lines. A line flows into the
+ * next instruction unless it is an unconditional jump, and a branch
+ * also into its target; a target outside the buffer (or falling off
+ * its end) is taken to need every register.
+ */
+void Peephole::ComputeLiveness()
+{
+  int n = lines.size();
+  std::vector<unsigned> liveIn(n, 0);
+  liveOut.assign(n, 0);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = n - 1; i >= 0; i--) {
+      const Line &l = lines[i];
+      if (l.deleted || (l.kind != Instr && l.kind != CodeLabel)) continue;
+      unsigned out = 0;
+      if (!(l.kind == Instr && (l.op == "b" || l.op == "j" || l.op == "jr"))) {
+        int next = Next(i);
+        out |= next < 0 ? ~0u : liveIn[next];
+      }
+      if (Target(l)) {
+        std::map<std::string, int>::iterator t = labels.find(Target(l));
+        out |= t == labels.end() ? ~0u : liveIn[t->second];
+      }
+      unsigned in = Uses(l) | (out & ~Defs(l));
+      if (in != liveIn[i] || out != liveOut[i]) changed = true;
+      liveIn[i] = in;
+      liveOut[i] = out;
+    }
+  }
+}
+
+// Only the registers that hold values of the program are ever found
+// dead; the others have fixed roles.
+bool Peephole::IsDeadAfter(const std::string &reg, int i)
+{
+  int r = RegisterNumber(reg);
+  bool general = (r >= RegisterNumber("$s0") && r <= RegisterNumber("$t9"));
+  return general && !(liveOut[i] & Bit(r));
+}
+
+
+// the next instruction or label after line i, -1 if none
+int Peephole::Next(int i)
+{
+  for (int j = i + 1; j < (int)lines.size(); j++)
+    if (!lines[j].deleted && (lines[j].kind == Instr || lines[j].kind == CodeLabel))
+      return j;
+  return -1;
+}
+
+// The next instruction (within a few) that reads the register line i
+// sets, as long as nothing in between jumps, is jumped to or changes
+// the register. -1 if there is none.
+int Peephole::NextUse(int i)
+{
+  unsigned reg = Defs(lines[i]);
+  int j = i;
+  for (int n = 0; n < Window; n++) {
+    j = Next(j);
+    if (j < 0 || lines[j].kind != Instr) return -1;
+    if (Uses(lines[j]) & reg) return j;
+    if ((Defs(lines[j]) & reg) || Target(lines[j]) || lines[j].op[0] == 'j') return -1;
+  }
+  return -1;
+}
+
+// Is label among the labels right after line i (so that jumping there
+// is the same as falling through)?
+bool Peephole::LabelFollows(int i, const std::string &label)
+{
+  for (int j = Next(i); j >= 0 && lines[j].kind == CodeLabel; j = Next(j))
+    if (lines[j].op == label) return true;
+  return false;
+}
+
+void Peephole::Delete(int i)
+{
+  lines[i].deleted = true;
+}
+
+void Peephole::Rewrite(int i, const char *op, std::string a1,
+                       std::string a2, std::string a3)
+{
+  Line &l = lines[i];
+  l.op = op;
+  l.args.clear();
+  l.args.push_back(a1);
+  if (!a2.empty()) l.args.push_back(a2);
+  if (!a3.empty()) l.args.push_back(a3);
+  l.comment = "";
+  l.text = l.op + " " + a1;
+  for (size_t a = 1; a < l.args.size(); a++)
+    l.text += ", " + l.args[a];
+}
+
+
+/* The rules. Each is handed an instruction and looks at it and the
+ * ones after it (if it needs to); it returns true if it rewrote any.
+ */
+
+// move $t0, $t0
+bool Peephole::SelfMove(int i)
+{
+  Line &l = lines[i];
+  if (l.op != "move" || l.args[0] != l.args[1]) return false;
+  Delete(i);
+  return true;
+}
+
+// sw $t2, -12($fp) ; lw $t0, -12($fp)  ->  sw ... ; move $t0, $t2
+bool Peephole::StoreLoad(int i)
+{
+  int j = Next(i);
+  if (lines[i].op != "sw" || j < 0 || lines[j].kind != Instr || lines[j].op != "lw"
+      || lines[j].args[1] != lines[i].args[1])
+    return false;
+  if (lines[j].args[0] == lines[i].args[0])
+    Delete(j);
+  else
+    Rewrite(j, "move", lines[j].args[0], lines[i].args[0]);
+  return true;
+}
+
+// lw $t1, 8($fp) ; lw $t0, 8($fp)  ->  lw ... ; move $t0, $t1
+bool Peephole::LoadLoad(int i)
+{
+  int j = Next(i);
+  if (lines[i].op != "lw" || j < 0 || lines[j].kind != Instr || lines[j].op != "lw"
+      || lines[j].args[1] != lines[i].args[1]
+      || BaseRegister(lines[i].args[1]) == RegisterNumber(lines[i].args[0]))
+    return false;
+  if (lines[j].args[0] == lines[i].args[0])
+    Delete(j);
+  else
+    Rewrite(j, "move", lines[j].args[0], lines[i].args[0]);
+  return true;
+}
+
+// b _L3 ; _L3:  ->  _L3:
+bool Peephole::BranchToNext(int i)
+{
+  if (!Target(lines[i]) || !LabelFollows(i, Target(lines[i]))) return false;
+  Delete(i);
+  return true;
+}
+
+// blt $t0, $t1, _L1 ; b _L2 ; _L1:  ->  bge $t0, $t1, _L2 ; _L1:
+bool Peephole::BranchOver(int i)
+{
+  static const char *opposite[][2] = {
+    {"beq", "bne"}, {"blt", "bge"}, {"ble", "bgt"},
+    {"beqz", "bnez"}, {"bltz", "bgez"}, {"blez", "bgtz"}, {NULL, NULL}};
+  Line &l = lines[i];
+  int j = Next(i);
+  if (!Target(l) || l.op == "b" || j < 0 || lines[j].kind != Instr || lines[j].op != "b"
+      || !LabelFollows(j, Target(l)))
+    return false;
+  const char *inverse = NULL;
+  for (int k = 0; opposite[k][0]; k++) {
+    if (l.op == opposite[k][0]) inverse = opposite[k][1];
+    if (l.op == opposite[k][1]) inverse = opposite[k][0];
+  }
+  if (!inverse) return false;
+  std::string target = lines[j].args[0];
+  if (l.args.size() == 2) Rewrite(i, inverse, l.args[0], target);
+  else Rewrite(i, inverse, l.args[0], l.args[1], target);
+  Delete(j);
+  return true;
+}
+
+// li $t1, 0 ; ... ; blt $t0, $t1, _L1  ->  li ... ; bltz $t0, _L1
+bool Peephole::CompareZero(int i)
+{
+  static const char *withZero[][3] = {   // op, zero second, zero first
+    {"beq", "beqz", "beqz"}, {"bne", "bnez", "bnez"}, {"blt", "bltz", "bgtz"},
+    {"ble", "blez", "bgez"}, {"bgt", "bgtz", "bltz"}, {"bge", "bgez", "blez"},
+    {NULL, NULL, NULL}};
+  if (lines[i].op != "li" || lines[i].args[1] != "0") return false;
+  int j = NextUse(i);
+  if (j < 0 || lines[j].args.size() != 3) return false;
+  Line &l = lines[j];
+  const std::string &zero = lines[i].args[0];
+  for (int k = 0; withZero[k][0]; k++) {
+    if (l.op != withZero[k][0] || l.args[0] == l.args[1]) continue;
+    if (l.args[1] == zero) {
+      Rewrite(j, withZero[k][1], l.args[0], l.args[2]);
+      return true;
+    }
+    if (l.args[0] == zero) {
+      Rewrite(j, withZero[k][2], l.args[1], l.args[2]);
+      return true;
+    }
+  }
+  return false;
+}
+
+// li $t1, 4 ; ... ; add $t0, $t2, $t1  ->  li ... ; addi $t0, $t2, 4
+// (the li is left for dead-def to remove if nothing else needs it)
+bool Peephole::Immediate(int i)
+{
+  int k;
+  if (lines[i].op != "li" || !IsNumber(lines[i].args[1], &k)) return false;
+  int j = NextUse(i);
+  if (j < 0 || lines[j].args.size() != 3) return false;
+  Line &l = lines[j];
+  const std::string &reg = lines[i].args[0];
+  bool second = l.args[2] == reg, first = l.args[1] == reg;
+  if (first == second) return false;
+  const std::string &other = first ? l.args[2] : l.args[1];
+  bool signed16 = k >= -32768 && k <= 32767, unsigned16 = k >= 0 && k <= 65535;
+
+  if (l.op == "add" && signed16)
+    Rewrite(j, "addi", l.args[0], other, lines[i].args[1]);
+  else if (l.op == "sub" && second && k > -32768 && k <= 32768)
+    Rewrite(j, "addi", l.args[0], other, Number(-k));
+  else if (l.op == "slt" && second && signed16)
+    Rewrite(j, "slti", l.args[0], other, lines[i].args[1]);
+  else if ((l.op == "and" || l.op == "or") && unsigned16)
+    Rewrite(j, l.op == "and" ? "andi" : "ori", l.args[0], other, lines[i].args[1]);
+  else if (l.op == "sllv" && second && k >= 0 && k <= 31)
+    Rewrite(j, "sll", l.args[0], other, lines[i].args[1]);
+  else if (l.op == "mul" && k > 0 && (k & (k - 1)) == 0) {
+    int shift = 0;
+    while ((1 << shift) != k) shift++;
+    Rewrite(j, "sll", l.args[0], other, Number(shift));
+  } else
+    return false;
+  return true;
+}
+
+// An instruction without side effects whose result is never read.
+bool Peephole::DeadDefinition(int i)
+{
+  static const char *pure[] = {"li", "la", "move", "slt", "slti", "seq", "and",
+                               "andi", "or", "ori", "sll", "sllv", "mul", NULL};
+  Line &l = lines[i];
+  for (int k = 0; pure[k]; k++) {
+    if (l.op != pure[k]) continue;
+    if (!IsDeadAfter(l.args[0], i)) return false;
+    Delete(i);
+    return true;
+  }
+  return false;
+}
+
+// Instructions after a jump or return that no label leads to.
+bool Peephole::Unreachable(int i)
+{
+  if (lines[i].op != "b" && lines[i].op != "j" && lines[i].op != "jr") return false;
+  bool removed = false;
+  for (int j = Next(i); j >= 0 && lines[j].kind == Instr; j = Next(j)) {
+    Delete(j);
+    removed = true;
+  }
+  return removed;
+}
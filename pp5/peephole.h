@@ -0,0 +1,89 @@
+/* File: peephole.h
+ * ----------------
+ * A peephole optimizer over the MIPS assembly the Mips class emits.
+ * Lines are buffered until the end of each function, then a window
+ * slides over the instructions (skipping the Tac comments and data
+ * directives in between) and a table of rules rewrites the wasteful
+ * patterns the one-instruction-at-a-time translation leaves:
+ *
+ *      sw $t2, -12($fp) ; lw $t0, -12($fp)   ->  sw ... ; move $t0, $t2
+ *      b _L3 ; _L3:                          ->  _L3:
+ *      li $t1, 4 ; add $t0, $t2, $t1         ->  addi $t0, $t2, 4
+ *
+ * Rules that drop the value of a register (the li above) need it to
+ * be dead afterwards, which a liveness pass over the registers of the
+ * buffered function tells. The rules run until none applies, and the
+ * number of times each one fired is reported under -d peephole.
+ */
+
+#ifndef _H_peephole
+#define _H_peephole
+
+#include <string>
+#include <vector>
+#include <map>
+
+class Peephole
+{
+  protected:
+    typedef enum { Instr, CodeLabel, Comment, Other } Kind;
+    struct Line {
+      Kind kind;
+      std::string text;             // as emitted, rebuilt if changed
+      std::string op, comment;
+      std::vector<std::string> args;
+      bool deleted;
+    };
+    struct Rule {
+      const char *name;
+      bool (Peephole::*apply)(int i);
+      int hits;
+    };
+    static Rule rules[];
+    static const int Window = 4;      // instructions looked ahead
+
+    std::vector<Line> lines;
+    std::vector<unsigned> liveOut;  // registers live after each line
+    std::map<std::string, int> labels;
+    bool inData;
+
+    static int RegisterNumber(const std::string &name);
+    static int BaseRegister(const std::string &address);
+    static bool IsBranch(const std::string &op);
+    unsigned Uses(const Line &l);
+    unsigned Defs(const Line &l);
+    const char *Target(const Line &l);
+    void ComputeLiveness();
+    bool IsDeadAfter(const std::string &reg, int i);
+
+    int Next(int i);
+    int NextUse(int i);
+    bool LabelFollows(int i, const std::string &label);
+    void Delete(int i);
+    void Rewrite(int i, const char *op, std::string a1,
+                 std::string a2 = "", std::string a3 = "");
+
+    bool SelfMove(int i);
+    bool StoreLoad(int i);
+    bool LoadLoad(int i);
+    bool BranchToNext(int i);
+    bool BranchOver(int i);
+    bool CompareZero(int i);
+    bool Immediate(int i);
+    bool DeadDefinition(int i);
+    bool Unreachable(int i);
+
+  public:
+    Peephole() : inData(false) {}
+
+         // Buffers one line of assembly (as passed to Mips::Emit)
+    void Add(const char *line);
+
+         // Optimizes the buffered lines and prints them
+    void Flush();
+
+         // Prints the hit counts of the rules (under -d peephole)
+    static void Report();
+};
+
+#endif
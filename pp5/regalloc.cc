@@ -0,0 +1,320 @@
+/* File: regalloc.cc
+ * -----------------
+ * Implementation of the graph coloring register allocator. Nodes of
+ * the interference graph are the variable indices handed out by the
+ * Liveness analysis; coalesced nodes are tracked with union-find and
+ * only the representative of each set carries edges.
+ */
+
+#include "regalloc.h"
+#include "liveness.h"
+#include "cfg.h"
+#include "codegen.h"
+#include <string.h>
+
+static const Mips::Register calleeSaved[] = {
+  Mips::s0, Mips::s1, Mips::s2, Mips::s3, Mips::s4, Mips::s5, Mips::s6, Mips::s7 };
+static const Mips::Register callerSaved[] = {
+  Mips::t3, Mips::t4, Mips::t5, Mips::t6, Mips::t7, Mips::t8, Mips::t9 };
+static const int NumCalleeSaved = sizeof(calleeSaved) / sizeof(calleeSaved[0]);
+static const int NumCallerSaved = sizeof(callerSaved) / sizeof(callerSaved[0]);
+
+
+RegisterAllocator::RegisterAllocator(FlowGraph *g, Liveness *l)
+{
+  graph = g;
+  live = l;
+  numVars = live->NumVars();
+  adj.resize(numVars);
+  crossesCall.resize(numVars, false);
+  cost.resize(numVars, 0);
+  color.resize(numVars, -1);
+  for (int i = 0; i < numVars; i++)
+    alias.push_back(i);
+}
+
+int RegisterAllocator::Find(int n)
+{
+  while (alias[n] != n)
+    n = alias[n] = alias[alias[n]];
+  return n;
+}
+
+void RegisterAllocator::AddInterference(int a, int b)
+{
+  if (a == b) return;
+  adj[a].insert(b);
+  adj[b].insert(a);
+}
+
+int RegisterAllocator::NumColors(int n)
+{
+  return crossesCall[n] ? NumCalleeSaved : NumCalleeSaved + NumCallerSaved;
+}
+
+
+/* Method: Build
+ * -------------
+ * Walks each block backwards from its live-out set, adding an edge
+ * between every definition and the variables live across it, and
+ * accumulating the spill costs. The variables live on entry to the
+ * function (the parameters, really) are all defined at once by the
+ * caller, so they interfere with one another; every parameter is
+ * loaded into its register by the prologue so they are all included.
+ */
+void RegisterAllocator::Build()
+{
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    double weight = 1;
+    for (int d = 0; d < b->loopDepth; d++)
+      weight *= 10;
+
+    VarSet cur = live->LiveOut(b);
+    std::list<Instruction*>::reverse_iterator p;
+    for (p = b->code.rbegin(); p != b->code.rend(); ++p) {
+      Instruction *instr = *p;
+      int def = live->Index(instr->GetDef());
+      Assign *copy = dynamic_cast<Assign*>(instr);
+      int src = copy ? live->Index(copy->GetSrc()) : -1;
+      if (copy && def >= 0 && src >= 0)
+        moves.Append(std::make_pair(def, src));
+
+      for (int v = 0; v < numVars; v++) {
+        if (!cur.Test(v) || v == def) continue;
+        if (instr->IsCall()) crossesCall[v] = true;
+        if (def >= 0 && v != src) AddInterference(def, v);
+      }
+      if (def >= 0) cost[def] += weight;
+      List<Location*> uses;
+      instr->GetUses(&uses);
+      for (int j = 0; j < uses.NumElements(); j++) {
+        int u = live->Index(uses.Nth(j));
+        if (u >= 0) cost[u] += weight;
+      }
+      live->Transfer(instr, cur);
+    }
+  }
+
+  std::vector<int> entry;
+  const VarSet &in = live->LiveIn(graph->GetEntry());
+  for (int v = 0; v < numVars; v++)
+    if (in.Test(v) || live->Var(v)->GetOffset() > 0)
+      entry.push_back(v);
+  for (size_t i = 0; i < entry.size(); i++)
+    for (size_t j = i + 1; j < entry.size(); j++)
+      AddInterference(entry[i], entry[j]);
+}
+
+
+/* Method: Combine
+ * ---------------
+ * Briggs' conservative test: a and b may be merged if the merged node
+ * has fewer significant-degree neighbors than it has colors, which
+ * guarantees it will still simplify. Returns true if they were merged.
+ */
+bool RegisterAllocator::Combine(int a, int b)
+{
+  if (adj[a].count(b)) return false;
+  bool calls = crossesCall[a] || crossesCall[b];
+  int k = calls ? NumCalleeSaved : NumCalleeSaved + NumCallerSaved;
+  std::set<int> neighbors(adj[a]);
+  neighbors.insert(adj[b].begin(), adj[b].end());
+  int significant = 0;
+  std::set<int>::iterator p;
+  for (p = neighbors.begin(); p != neighbors.end(); ++p)
+    if ((int)adj[*p].size() >= NumColors(*p)) significant++;
+  if (significant >= k) return false;
+
+  for (p = adj[b].begin(); p != adj[b].end(); ++p) {
+    adj[*p].erase(b);
+    AddInterference(a, *p);
+  }
+  adj[b].clear();
+  alias[b] = a;
+  cost[a] += cost[b];
+  crossesCall[a] = calls;
+  return true;
+}
+
+void RegisterAllocator::Coalesce()
+{
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = 0; i < moves.NumElements(); i++) {
+      int a = Find(moves.Nth(i).first), b = Find(moves.Nth(i).second);
+      if (a != b && Combine(a, b))
+        changed = true;
+    }
+  }
+}
+
+
+/* Method: Choose
+ * --------------
+ * Picks a register for node n that none of its colored neighbors
+ * (used) has. A register already given to a copy partner is preferred
+ * since that makes the copy disappear; otherwise nodes that cross
+ * calls take a callee-saved register and the rest a caller-saved one
+ * if possible, so that fewer $s registers need saving. Returns zero
+ * if no register is left.
+ */
+Mips::Register RegisterAllocator::Choose(int n, std::set<Mips::Register> &used)
+{
+  for (int i = 0; i < moves.NumElements(); i++) {
+    int a = Find(moves.Nth(i).first), b = Find(moves.Nth(i).second);
+    int partner = (a == n) ? b : (b == n) ? a : -1;
+    if (partner < 0 || color[partner] < 0) continue;
+    Mips::Register r = (Mips::Register)color[partner];
+    bool saved = r >= Mips::s0 && r <= Mips::s7;
+    if (!used.count(r) && (saved || !crossesCall[n])) return r;
+  }
+  if (!crossesCall[n]) {
+    for (int i = 0; i < NumCallerSaved; i++)
+      if (!used.count(callerSaved[i])) return callerSaved[i];
+  }
+  for (int i = 0; i < NumCalleeSaved; i++)
+    if (!used.count(calleeSaved[i])) return calleeSaved[i];
+  return Mips::zero;
+}
+
+void RegisterAllocator::Select(List<int> &stack)
+{
+  for (int i = stack.NumElements() - 1; i >= 0; i--) {
+    int n = stack.Nth(i);
+    std::set<Mips::Register> used;
+    std::set<int>::iterator p;
+    for (p = adj[n].begin(); p != adj[n].end(); ++p)
+      if (color[*p] >= 0) used.insert((Mips::Register)color[*p]);
+    Mips::Register r = Choose(n, used);
+    if (r != Mips::zero) color[n] = r;
+  }
+}
+
+
+std::map<Location*, int> *RegisterAllocator::Allocate()
+{
+  Build();
+  Coalesce();
+
+  // simplify, removing nodes onto the stack
+  std::vector<int> degree(numVars);
+  std::vector<bool> removed(numVars, false);
+  int remaining = 0;
+  for (int i = 0; i < numVars; i++) {
+    if (Find(i) != i) {
+      removed[i] = true;
+      continue;
+    }
+    degree[i] = adj[i].size();
+    remaining++;
+  }
+  List<int> stack;
+  while (remaining > 0) {
+    int pick = -1;
+    for (int i = 0; i < numVars && pick < 0; i++)
+      if (!removed[i] && degree[i] < NumColors(i)) pick = i;
+    if (pick < 0) {
+      // no trivially colorable node left, push the cheapest to spill
+      for (int i = 0; i < numVars; i++)
+        if (!removed[i] && (pick < 0 || cost[i] / degree[i] < cost[pick] / degree[pick]))
+          pick = i;
+    }
+    removed[pick] = true;
+    remaining--;
+    stack.Append(pick);
+    std::set<int>::iterator p;
+    for (p = adj[pick].begin(); p != adj[pick].end(); ++p)
+      degree[*p]--;
+  }
+  Select(stack);
+
+  std::map<Location*, int> *result = new std::map<Location*, int>;
+  for (int i = 0; i < numVars; i++)
+    if (color[Find(i)] >= 0)
+      (*result)[live->Var(i)] = color[Find(i)];
+  return result;
+}
+
+
+StackSlotAllocator::StackSlotAllocator(FlowGraph *g, Liveness *l,
+                                       std::map<Location*, int> *r)
+{
+  graph = g;
+  live = l;
+  registers = r;
+}
+
+// Compiler-generated names start with an underscore, which Decaf
+// identifiers can't. SSA versions (x.1) are always assigned before
+// they are used, so they are as good as temps.
+bool StackSlotAllocator::IsTemp(Location *var)
+{
+  return var->GetName()[0] == '_' || strchr(var->GetName(), '.');
+}
+
+bool StackSlotAllocator::NeedsSlot(Location *var)
+{
+  return var->GetOffset() < 0 && !(registers && registers->count(var));
+}
+
+void StackSlotAllocator::Allocate()
+{
+  int numVars = live->NumVars();
+  std::vector< std::set<int> > adj(numVars);
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    VarSet cur = live->LiveOut(b);
+    std::list<Instruction*>::reverse_iterator p;
+    for (p = b->code.rbegin(); p != b->code.rend(); ++p) {
+      int def = live->Index((*p)->GetDef());
+      if (def >= 0 && IsTemp(live->Var(def))) {
+        for (int v = 0; v < numVars; v++)
+          if (v != def && cur.Test(v) && IsTemp(live->Var(v))) {
+            adj[def].insert(v);
+            adj[v].insert(def);
+          }
+      }
+      live->Transfer(*p, cur);
+    }
+  }
+
+  // declared locals first, then the shared temp slots below them
+  int next = CodeGenerator::OffsetToFirstLocal;
+  for (int v = 0; v < numVars; v++) {
+    Location *var = live->Var(v);
+    if (NeedsSlot(var) && !IsTemp(var)) {
+      var->SetOffset(next);
+      next -= CodeGenerator::VarSize;
+    }
+  }
+  std::vector<int> slot(numVars, -1);
+  int numSlots = 0;
+  for (int v = 0; v < numVars; v++) {
+    Location *var = live->Var(v);
+    if (!NeedsSlot(var) || !IsTemp(var)) continue;
+    std::set<int> taken;
+    std::set<int>::iterator p;
+    for (p = adj[v].begin(); p != adj[v].end(); ++p)
+      if (slot[*p] >= 0) taken.insert(slot[*p]);
+    int s = 0;
+    while (taken.count(s)) s++;
+    slot[v] = s;
+    if (s == numSlots) numSlots++;
+    var->SetOffset(next - s * CodeGenerator::VarSize);
+  }
+  // then the blocks escape analysis moved into the frame
+  int low = next - numSlots * CodeGenerator::VarSize;
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    std::list<Instruction*>::iterator p;
+    for (p = b->code.begin(); p != b->code.end(); ++p) {
+      StackBlock *block = dynamic_cast<StackBlock*>(*p);
+      if (!block) continue;
+      low -= block->GetBytes();
+      block->SetOffset(low + CodeGenerator::VarSize);
+    }
+  }
+  graph->GetBeginFunc()->SetFrameSize(CodeGenerator::OffsetToFirstLocal - low);
+}
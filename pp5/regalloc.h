@@ -0,0 +1,99 @@
+/* File: regalloc.h
+ * ----------------
+ * The RegisterAllocator class assigns machine registers to the
+ * variables of one function by coloring its interference graph, in
+ * the style of Chaitin and Briggs:
+ *
+ *   - build: two variables interfere when one is defined while the
+ *     other is live (the source of a copy is exempt, so the copy can
+ *     be coalesced away). Variables live across a call are marked.
+ *   - coalesce: the two ends of an Assign that don't interfere are
+ *     merged when Briggs' conservative test says the merged node is
+ *     still colorable.
+ *   - simplify: nodes of low degree are removed first; when none is
+ *     left the node with the lowest spill cost (uses and defs weighted
+ *     by 10^loop depth, divided by degree) is removed optimistically.
+ *   - select: nodes are colored in reverse removal order, preferring
+ *     the color of an already colored copy partner.
+ *
+ * Variables live across a LCall/ACall may only get the callee-saved
+ * $s registers, which the function saves in its prologue; all others
+ * prefer the caller-saved $t3-$t9. $t0-$t2 stay reserved as scratch
+ * registers for the variables that don't get a register, those are
+ * simply left in their stack slots.
+ */
+
+#ifndef _H_regalloc
+#define _H_regalloc
+
+#include <map>
+#include <set>
+#include <vector>
+#include "mips.h"
+
+class FlowGraph;
+class Liveness;
+
+class RegisterAllocator
+{
+  protected:
+    FlowGraph *graph;
+    Liveness *live;
+    int numVars;
+    std::vector< std::set<int> > adj;
+    std::vector<int> alias;           // union-find of coalesced nodes
+    std::vector<bool> crossesCall;
+    std::vector<double> cost;
+    std::vector<int> color;
+    List<std::pair<int,int> > moves;
+
+    int Find(int n);
+    void AddInterference(int a, int b);
+    int NumColors(int n);
+    void Build();
+    void Coalesce();
+    bool Combine(int a, int b);
+    void Select(List<int> &stack);
+    Mips::Register Choose(int n, std::set<Mips::Register> &used);
+
+  public:
+         // Building and coloring the graph is quadratic in the number
+         // of variables; functions with more than this many are left
+         // to the basic-block register cache in the Mips class
+    static const int MaxVariables = 1500;
+
+    RegisterAllocator(FlowGraph *graph, Liveness *live);
+
+         // Colors the graph and returns the register (a Mips::Register)
+         // chosen for each variable. Variables that are not in the map
+         // live in their stack slots.
+    std::map<Location*, int> *Allocate();
+};
+
+
+/* The StackSlotAllocator class lays out the locals area of a frame
+ * once registers have been allocated. Every temp generated by the
+ * code generator used to get a slot of its own; now temps whose live
+ * ranges don't overlap share a slot (greedy coloring of the temps'
+ * interference graph). Declared locals keep a slot each (an
+ * uninitialized one reads the same slot every time), and variables
+ * that live in registers get none. Offsets of the Locations and the
+ * frame size in BeginFunc are rewritten accordingly.
+ */
+class StackSlotAllocator
+{
+  protected:
+    FlowGraph *graph;
+    Liveness *live;
+    std::map<Location*, int> *registers;
+
+    bool NeedsSlot(Location *var);
+    static bool IsTemp(Location *var);
+
+  public:
+    StackSlotAllocator(FlowGraph *graph, Liveness *live,
+                       std::map<Location*, int> *registers);
+    void Allocate();
+};
+
+#endif
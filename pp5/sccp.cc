@@ -0,0 +1,246 @@
+/* File: sccp.cc
+ * -------------
+ * Implementation of sparse conditional constant propagation.
+ */
+
+#include "sccp.h"
+#include "cfg.h"
+#include "ssa.h"
+
+
+ConstantPropagation::ConstantPropagation(FlowGraph *g)
+{
+  graph = g;
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    std::list<Instruction*>::iterator p;
+    for (p = b->code.begin(); p != b->code.end(); ++p) {
+      blockOf[*p] = b;
+      Location *dst = (*p)->GetDef();
+      if (dst && dst->GetSegment() == fpRelative) values[dst] = Value();
+      List<Location*> used;
+      (*p)->GetUses(&used);
+      for (int j = 0; j < used.NumElements(); j++) {
+        if (!uses.count(used.Nth(j))) uses[used.Nth(j)] = new List<Instruction*>;
+        uses[used.Nth(j)]->Append(*p);
+      }
+    }
+  }
+}
+
+// Anything not defined in the function (parameters, the entry values
+// of locals, globals) could hold any value.
+ConstantPropagation::Value ConstantPropagation::Get(Location *loc)
+{
+  if (loc->GetSegment() != fpRelative) return Value(Overdefined);
+  std::map<Location*, Value>::iterator p = values.find(loc);
+  return p == values.end() ? Value(Overdefined) : p->second;
+}
+
+ConstantPropagation::Value ConstantPropagation::Meet(Value a, Value b)
+{
+  if (a.state == Undefined) return b;
+  if (b.state == Undefined) return a;
+  if (a.state == Overdefined || b.state == Overdefined || a.constant != b.constant)
+    return Value(Overdefined);
+  return a;
+}
+
+ConstantPropagation::Value ConstantPropagation::Evaluate(Instruction *instr, BasicBlock *b)
+{
+  if (dynamic_cast<LoadConstant*>(instr))
+    return Value(Constant, dynamic_cast<LoadConstant*>(instr)->GetValue());
+  if (dynamic_cast<Assign*>(instr))
+    return Get(dynamic_cast<Assign*>(instr)->GetSrc());
+
+  if (dynamic_cast<Phi*>(instr)) {
+    Phi *phi = dynamic_cast<Phi*>(instr);
+    Value result;
+    for (int i = 0; i < phi->NumArgs(); i++)
+      if (executable.count(Edge(phi->GetPred(i), b)))
+        result = Meet(result, Get(phi->GetArg(i)));
+    return result;
+  }
+
+  if (dynamic_cast<BinaryOp*>(instr)) {
+    BinaryOp *op = dynamic_cast<BinaryOp*>(instr);
+    Value a = Get(op->GetOp1()), c = Get(op->GetOp2());
+    int result;
+    if (a.state == Overdefined || c.state == Overdefined) return Value(Overdefined);
+    if (a.state == Undefined || c.state == Undefined) return Value(Undefined);
+    if (BinaryOp::Evaluate(op->GetCode(), a.constant, c.constant, &result))
+      return Value(Constant, result);
+  }
+  return Value(Overdefined);
+}
+
+/* Method: Taken
+ * -------------
+ * Evaluates a conditional branch: constant 1 if it is always taken, 0
+ * if it never is. Anything else is overdefined.
+ */
+ConstantPropagation::Value ConstantPropagation::Taken(Instruction *branch)
+{
+  if (dynamic_cast<IfZ*>(branch)) {
+    Value test = Get(dynamic_cast<IfZ*>(branch)->GetTest());
+    return test.state == Constant ? Value(Constant, test.constant == 0) : test;
+  }
+  IfCompare *cmp = dynamic_cast<IfCompare*>(branch);
+  if (!cmp) return Value(Overdefined);
+  Value a = Get(cmp->GetOp1()), c = Get(cmp->GetOp2());
+  if (a.state == Overdefined || c.state == Overdefined) return Value(Overdefined);
+  if (a.state == Undefined || c.state == Undefined) return Value(Undefined);
+  return Value(Constant, IfCompare::Evaluate(cmp->GetRelation(), a.constant, c.constant));
+}
+
+/* Method: BranchTarget
+ * --------------------
+ * Returns the successor of b (which ends in a conditional branch) that
+ * is reached when the branch is taken, or when it falls through.
+ */
+BasicBlock *ConstantPropagation::BranchTarget(BasicBlock *b, bool taken)
+{
+  Instruction *branch = b->GetLast();
+  BasicBlock *target = graph->BlockForLabel(branch->branch_label());
+  if (taken) return target;
+  for (int i = 0; i < b->succs->NumElements(); i++)
+    if (b->succs->Nth(i) != target) return b->succs->Nth(i);
+  return target;
+}
+
+void ConstantPropagation::AddSuccessors(BasicBlock *b)
+{
+  Value taken = Taken(b->GetLast());
+  if (taken.state == Constant) {
+    flowWork.push_back(Edge(b, BranchTarget(b, taken.constant)));
+  } else if (taken.state == Overdefined) {
+    for (int i = 0; i < b->succs->NumElements(); i++)
+      flowWork.push_back(Edge(b, b->succs->Nth(i)));
+  }
+}
+
+void ConstantPropagation::Visit(Instruction *instr, BasicBlock *b)
+{
+  if (dynamic_cast<IfZ*>(instr) || dynamic_cast<IfCompare*>(instr)) {
+    AddSuccessors(b);
+    return;
+  }
+  Location *dst = instr->GetDef();
+  if (!dst || !values.count(dst)) return;
+  Value v = Evaluate(instr, b);
+  if (!(v != values[dst])) return;
+  values[dst] = v;
+  if (uses.count(dst))
+    for (int i = 0; i < uses[dst]->NumElements(); i++)
+      ssaWork.push_back(uses[dst]->Nth(i));
+}
+
+
+/* Method: Rewrite
+ * ---------------
+ * Replaces the definitions of constants in the reached blocks by
+ * LoadConstant. The ones for phis go after the last phi of the block.
+ */
+int ConstantPropagation::Rewrite()
+{
+  int folded = 0;
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    if (!reached.count(b)) continue;
+    List<Instruction*> fromPhis;
+    std::list<Instruction*>::iterator p = b->code.begin();
+    while (p != b->code.end()) {
+      Location *dst = (*p)->GetDef();
+      Value v = dst ? Get(dst) : Value(Overdefined);
+      if (v.state != Constant || dynamic_cast<LoadConstant*>(*p)) {
+        ++p;
+      } else if (dynamic_cast<Phi*>(*p)) {
+        fromPhis.Append(new LoadConstant(dst, v.constant));
+        p = b->code.erase(p);
+        folded++;
+      } else {
+        *p++ = new LoadConstant(dst, v.constant);
+        folded++;
+      }
+    }
+    p = b->code.begin();
+    while (p != b->code.end() && (dynamic_cast<Label*>(*p) || dynamic_cast<Phi*>(*p)))
+      ++p;
+    for (int j = 0; j < fromPhis.NumElements(); j++)
+      b->code.insert(p, fromPhis.Nth(j));
+  }
+  return folded;
+}
+
+/* Method: RemoveBranches
+ * ----------------------
+ * A conditional branch on constants becomes a Goto if it is always
+ * taken and is deleted if it never is.
+ */
+int ConstantPropagation::RemoveBranches()
+{
+  int folded = 0;
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    Instruction *branch = b->GetLast();
+    if (!branch || !reached.count(b)) continue;
+    Value taken = Taken(branch);
+    if (taken.state != Constant) continue;
+    b->code.pop_back();
+    if (taken.constant)
+      b->code.push_back(new Goto(branch->branch_label()));
+    folded++;
+  }
+  return folded;
+}
+
+
+int ConstantPropagation::Run(int *blocksRemoved)
+{
+  flowWork.push_back(Edge(NULL, graph->GetEntry()));
+  while (!flowWork.empty() || !ssaWork.empty()) {
+    if (!flowWork.empty()) {
+      Edge e = flowWork.back();
+      flowWork.pop_back();
+      if (executable.count(e)) continue;
+      executable.insert(e);
+      BasicBlock *b = e.second;
+      bool first = !reached.count(b);
+      reached.insert(b);
+      std::list<Instruction*>::iterator p;
+      for (p = b->code.begin(); p != b->code.end(); ++p)
+        if (first || dynamic_cast<Phi*>(*p))
+          Visit(*p, b);
+      Instruction *last = b->GetLast();
+      if (first && !dynamic_cast<IfZ*>(last) && !dynamic_cast<IfCompare*>(last))
+        AddSuccessors(b);
+    } else {
+      Instruction *instr = ssaWork.back();
+      ssaWork.pop_back();
+      if (reached.count(blockOf[instr]))
+        Visit(instr, blockOf[instr]);
+    }
+  }
+
+  int folded = Rewrite() + RemoveBranches();
+  int before = graph->NumBlocks();
+  graph->Rebuild();
+  graph->RemoveUnreachableBlocks();
+  *blocksRemoved = before - graph->NumBlocks();
+
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    List<Phi*> phis;
+    SSAForm::GetPhis(b, &phis);
+    for (int j = 0; j < phis.NumElements(); j++) {
+      Phi *phi = phis.Nth(j);
+      for (int k = phi->NumArgs() - 1; k >= 0; k--) {
+        bool found = false;
+        for (int n = 0; n < b->preds->NumElements(); n++)
+          if (b->preds->Nth(n) == phi->GetPred(k)) found = true;
+        if (!found) phi->RemovePred(phi->GetPred(k));
+      }
+    }
+  }
+  return folded;
+}
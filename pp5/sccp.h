@@ -0,0 +1,71 @@
+/* File: sccp.h
+ * ------------
+ * Sparse conditional constant propagation (Wegman & Zadeck) over a
+ * function in SSA form. Each SSA name starts out undefined and can
+ * only move down to a known constant and from there to "overdefined".
+ * Blocks start out unreachable; the entry is reached, and a reached
+ * block reaches its successors, except that a conditional branch (IfZ
+ * or IfCompare) on constants only reaches the side it takes. Phis merge only the arguments coming in
+ * over edges found to be executable, so a value that is constant on
+ * every path actually taken stays constant.
+ *
+ * Afterwards every definition of a constant is replaced by a
+ * LoadConstant, a branch on constants becomes a Goto or disappears, and
+ * the blocks never reached are deleted (along with their phi
+ * arguments). Parameters, globals, loads and call results are never
+ * constant.
+ */
+
+#ifndef _H_sccp
+#define _H_sccp
+
+#include <map>
+#include <set>
+#include <vector>
+#include "list.h"
+#include "tac.h"
+
+class FlowGraph;
+class BasicBlock;
+
+class ConstantPropagation
+{
+  protected:
+    enum State { Undefined, Constant, Overdefined };
+    struct Value {
+      State state;
+      int constant;
+      Value(State s = Undefined, int c = 0) : state(s), constant(c) {}
+      bool operator!=(const Value &v) const
+        { return state != v.state || (state == Constant && constant != v.constant); }
+    };
+    typedef std::pair<BasicBlock*, BasicBlock*> Edge;
+
+    FlowGraph *graph;
+    std::map<Location*, Value> values;
+    std::map<Location*, List<Instruction*>*> uses;
+    std::map<Instruction*, BasicBlock*> blockOf;
+    std::set<BasicBlock*> reached;
+    std::set<Edge> executable;
+    std::vector<Edge> flowWork;
+    std::vector<Instruction*> ssaWork;
+
+    Value Get(Location *loc);
+    Value Meet(Value a, Value b);
+    Value Evaluate(Instruction *instr, BasicBlock *b);
+    Value Taken(Instruction *branch);
+    void Visit(Instruction *instr, BasicBlock *b);
+    void AddSuccessors(BasicBlock *b);
+    BasicBlock *BranchTarget(BasicBlock *b, bool taken);
+    int Rewrite();
+    int RemoveBranches();
+
+  public:
+    ConstantPropagation(FlowGraph *graph);
+
+         // Returns the number of instructions folded; blocksRemoved
+         // is set to the number of unreachable blocks deleted
+    int Run(int *blocksRemoved);
+};
+
+#endif
@@ -0,0 +1,154 @@
+/* File: shrinkwrap.cc
+ * -------------------
+ * Implementation of the placement of the $ra saves.
+ */
+
+#include "shrinkwrap.h"
+#include "cfg.h"
+#include <string.h>
+
+
+bool ShrinkWrap::IsCall(Instruction *instr)
+{
+  LCall *call = dynamic_cast<LCall*>(instr);
+  if (call && !strcmp(call->GetLabel(), "_Halt")) return false;
+  return instr->IsCall() && !dynamic_cast<TailCall*>(instr);
+}
+
+// The blocks control goes on to from b within the body: a Return
+// leaves from b itself and a _Halt never leaves, though both have an
+// edge to the exit block.
+void ShrinkWrap::FlowSuccessors(BasicBlock *b, List<BasicBlock*> *succs)
+{
+  Instruction *last = b->GetLast();
+  LCall *call = dynamic_cast<LCall*>(last);
+  if (dynamic_cast<Return*>(last) || (call && !strcmp(call->GetLabel(), "_Halt")))
+    return;
+  for (int i = 0; i < b->succs->NumElements(); i++)
+    succs->Append(b->succs->Nth(i));
+}
+
+void ShrinkWrap::SetRestores(bool restores)
+{
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    std::list<Instruction*>::iterator p;
+    for (p = b->code.begin(); p != b->code.end(); ++p) {
+      if (dynamic_cast<Return*>(*p))
+        dynamic_cast<Return*>(*p)->SetRestoresRA(restores);
+      if (dynamic_cast<EndFunc*>(*p))
+        dynamic_cast<EndFunc*>(*p)->SetRestoresRA(restores);
+    }
+  }
+}
+
+int ShrinkWrap::Run()
+{
+  BeginFunc *begin = graph->GetBeginFunc();
+  bool leaf = true, anyCall = false;
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    std::list<Instruction*>::iterator p;
+    for (p = b->code.begin(); p != b->code.end(); ++p) {
+      if ((*p)->IsCall() || dynamic_cast<PushParam*>(*p)) leaf = false;
+      if (IsCall(*p)) calls[b] = anyCall = true;
+    }
+  }
+  begin->SetLeaf(leaf);
+  begin->SetSavesRA(anyCall);
+  SetRestores(anyCall);
+  if (!anyCall) return 0;
+
+  // every path from the block reaches a call (a greatest fixed point,
+  // so loops without a way out count as reaching one)
+  std::map<BasicBlock*, List<BasicBlock*>*> succs, preds;
+  std::map<BasicBlock*, bool> needs;
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    succs[b] = new List<BasicBlock*>;
+    if (!preds.count(b)) preds[b] = new List<BasicBlock*>;
+    FlowSuccessors(b, succs[b]);
+    for (int j = 0; j < succs[b]->NumElements(); j++) {
+      BasicBlock *s = succs[b]->Nth(j);
+      if (!preds.count(s)) preds[s] = new List<BasicBlock*>;
+      preds[s]->Append(b);
+    }
+    needs[b] = true;
+  }
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = graph->NumBlocks() - 1; i >= 0; i--) {
+      BasicBlock *b = graph->Nth(i);
+      bool n = calls[b] || succs[b]->NumElements() > 0;
+      for (int j = 0; !calls[b] && j < succs[b]->NumElements(); j++)
+        n = n && needs[succs[b]->Nth(j)];
+      if (n != needs[b]) changed = true;
+      needs[b] = n;
+    }
+  }
+
+  List<BasicBlock*> saves;
+  if (needs[graph->GetEntry()]) return -1;
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    if (!needs[b] || !b->IsReachable()) continue;
+    bool first = false;
+    for (int j = 0; j < preds[b]->NumElements(); j++)
+      if (!needs[preds[b]->Nth(j)]) first = true;
+    if (!first) continue;
+    if (b->loopDepth > 0) return -1;
+    saves.Append(b);
+  }
+
+  // whether $ra was saved on all (must) and on some (may) paths to
+  // the end of each block
+  std::map<BasicBlock*, bool> must, may;
+  List<BasicBlock*> *order = graph->ReversePostorder();
+  for (int i = 0; i < order->NumElements(); i++)
+    must[order->Nth(i)] = true;
+  changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = 0; i < order->NumElements(); i++) {
+      BasicBlock *b = order->Nth(i);
+      bool in = preds[b]->NumElements() > 0, inMay = false;
+      for (int j = 0; j < preds[b]->NumElements(); j++) {
+        BasicBlock *p = preds[b]->Nth(j);
+        if (!p->IsReachable()) continue;
+        in = in && must[p];
+        inMay = inMay || may[p];
+      }
+      bool saved = false;
+      for (int j = 0; j < saves.NumElements(); j++)
+        if (saves.Nth(j) == b) saved = true;
+      if ((in || saved) != must[b] || (inMay || saved) != may[b]) changed = true;
+      must[b] = in || saved;
+      may[b] = inMay || saved;
+    }
+  }
+
+  for (int i = 0; i < order->NumElements(); i++) {
+    BasicBlock *b = order->Nth(i);
+    if ((dynamic_cast<Return*>(b->GetLast()) || b == graph->GetExit())
+        && must[b] != may[b])
+      return -1;
+  }
+
+  begin->SetSavesRA(false);
+  SetRestores(false);
+  for (int i = 0; i < order->NumElements(); i++) {
+    BasicBlock *b = order->Nth(i);
+    Return *ret = dynamic_cast<Return*>(b->GetLast());
+    if (ret) ret->SetRestoresRA(must[b]);
+    if (b == graph->GetExit())
+      dynamic_cast<EndFunc*>(b->GetLast())->SetRestoresRA(must[b]);
+  }
+  for (int i = 0; i < saves.NumElements(); i++) {
+    BasicBlock *b = saves.Nth(i);
+    std::list<Instruction*>::iterator p = b->code.begin();
+    if (b->GetLabel()) ++p;
+    b->code.insert(p, new SaveRA);
+  }
+  return saves.NumElements();
+}
@@ -0,0 +1,48 @@
+/* File: shrinkwrap.h
+ * ------------------
+ * Decides where a function saves $ra, once its frame is final. Only a
+ * call (jal, jalr) overwrites $ra, so a function that makes none need
+ * not save it, and a leaf that neither calls nor pushes anything and
+ * keeps nothing in its frame gets no frame at all (see
+ * Mips::EmitBeginFunction); small accessors compile to a few loads and
+ * a jr. A call to _Halt doesn't count, it never comes back.
+ *
+ * Otherwise $ra is saved on the paths to a call only. A block needs it
+ * saved if every path from it reaches a call; SaveRA goes at the top
+ * of the first such blocks (those with a predecessor that doesn't),
+ * and each Return restores $ra if it was saved on the way to it. That
+ * has to hold on every path to a given return or on none, and no save
+ * may land in a loop, where it would run on each iteration; if either
+ * fails the prologue saves $ra as it always did.
+ */
+
+#ifndef _H_shrinkwrap
+#define _H_shrinkwrap
+
+#include <map>
+#include "list.h"
+#include "tac.h"
+
+class FlowGraph;
+class BasicBlock;
+
+class ShrinkWrap
+{
+  protected:
+    FlowGraph *graph;
+    std::map<BasicBlock*, bool> calls, returns;
+
+    bool IsCall(Instruction *instr);
+    void FlowSuccessors(BasicBlock *b, List<BasicBlock*> *succs);
+    void SetRestores(bool restores);
+
+  public:
+    ShrinkWrap(FlowGraph *graph) : graph(graph) {}
+
+         // Marks the BeginFunc, Returns and EndFunc and inserts the
+         // SaveRAs. Returns the number of SaveRAs, or -1 if the
+         // prologue saves $ra.
+    int Run();
+};
+
+#endif
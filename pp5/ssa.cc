@@ -0,0 +1,253 @@
+/* File: ssa.cc
+ * ------------
+ * Implementation of the conversion into and out of SSA form.
+ */
+
+#include "ssa.h"
+#include "cfg.h"
+#include "liveness.h"
+#include "codegen.h"
+#include <string.h>
+
+
+SSAForm::SSAForm(FlowGraph *g)
+{
+  graph = g;
+  live = NULL;
+}
+
+void SSAForm::GetPhis(BasicBlock *b, List<Phi*> *phis)
+{
+  std::list<Instruction*>::iterator p = b->code.begin();
+  if (p != b->code.end() && dynamic_cast<Label*>(*p)) ++p;
+  for (; p != b->code.end(); ++p) {
+    Phi *phi = dynamic_cast<Phi*>(*p);
+    if (!phi) break;
+    phis->Append(phi);
+  }
+}
+
+void SSAForm::InsertBeforeBranch(BasicBlock *b, Instruction *instr)
+{
+  Instruction *last = b->GetLast();
+  if (last && last->branch_label())
+    b->code.insert(--b->code.end(), instr);
+  else
+    b->code.push_back(instr);
+}
+
+
+/* Method: ComputeFrontiers
+ * ------------------------
+ * The dominance frontier of b is the set of blocks where b's dominance
+ * ends: b dominates a predecessor of each of them but not the block
+ * itself (strictly). Computed by walking up the dominator tree from
+ * the predecessors of every join point.
+ */
+void SSAForm::ComputeFrontiers()
+{
+  List<BasicBlock*> *order = graph->ReversePostorder();
+  for (int i = 0; i < order->NumElements(); i++) {
+    BasicBlock *b = order->Nth(i);
+    if (b->preds->NumElements() < 2) continue;
+    for (int j = 0; j < b->preds->NumElements(); j++) {
+      BasicBlock *runner = b->preds->Nth(j);
+      while (runner && runner != b->idom) {
+        frontier[runner].insert(b);
+        runner = runner->idom;
+      }
+    }
+  }
+}
+
+void SSAForm::PlacePhis()
+{
+  std::vector< std::set<BasicBlock*> > defSites(live->NumVars());
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    std::list<Instruction*>::iterator p;
+    for (p = b->code.begin(); p != b->code.end(); ++p) {
+      int def = live->Index((*p)->GetDef());
+      if (def >= 0) defSites[def].insert(b);
+    }
+  }
+
+  for (int v = 0; v < live->NumVars(); v++) {
+    std::set<BasicBlock*> hasPhi;
+    List<BasicBlock*> work;
+    std::set<BasicBlock*>::iterator p;
+    for (p = defSites[v].begin(); p != defSites[v].end(); ++p)
+      work.Append(*p);
+    while (work.NumElements() > 0) {
+      BasicBlock *x = work.Nth(work.NumElements() - 1);
+      work.RemoveAt(work.NumElements() - 1);
+      std::set<BasicBlock*> &df = frontier[x];
+      for (p = df.begin(); p != df.end(); ++p) {
+        BasicBlock *y = *p;
+        if (hasPhi.count(y) || !live->LiveIn(y).Test(v)) continue;
+        hasPhi.insert(y);
+        Phi *phi = new Phi(live->Var(v), y->preds);
+        phiVar[phi] = v;
+        std::list<Instruction*>::iterator pos = y->code.begin();
+        if (pos != y->code.end() && dynamic_cast<Label*>(*pos)) ++pos;
+        y->code.insert(pos, phi);
+        if (!defSites[v].count(y)) work.Append(y);
+      }
+    }
+  }
+}
+
+Location *SSAForm::NewVersion(int var)
+{
+  char name[128];
+  snprintf(name, sizeof(name), "%s.%d", live->Var(var)->GetName(), ++versions[var]);
+  Location *result = graph->NewTemp(strdup(name));
+  result->SetPointer(live->Var(var)->GetPointer());
+  stacks[var]->Append(result);
+  return result;
+}
+
+/* Method: Rename
+ * --------------
+ * Walks the dominator tree from b. Uses are replaced by the version on
+ * top of their variable's stack and each definition pushes a new one,
+ * the phi arguments of the successors are filled in from the stacks
+ * as they are at the end of b. The versions pushed in b are popped
+ * again before returning.
+ */
+void SSAForm::Rename(BasicBlock *b)
+{
+  List<int> pushed;
+  std::list<Instruction*>::iterator p;
+  for (p = b->code.begin(); p != b->code.end(); ++p) {
+    Instruction *instr = *p;
+    Phi *phi = dynamic_cast<Phi*>(instr);
+    if (phi) {
+      instr->SetDef(NewVersion(phiVar[phi]));
+      pushed.Append(phiVar[phi]);
+      continue;
+    }
+    List<Location*> uses;
+    instr->GetUses(&uses);
+    for (int i = 0; i < uses.NumElements(); i++) {
+      int v = live->Index(uses.Nth(i));
+      if (v < 0) continue;
+      Location *top = stacks[v]->Nth(stacks[v]->NumElements() - 1);
+      if (top != uses.Nth(i)) instr->ReplaceUse(uses.Nth(i), top);
+    }
+    int def = live->Index(instr->GetDef());
+    if (def >= 0) {
+      instr->SetDef(NewVersion(def));
+      pushed.Append(def);
+    }
+  }
+
+  for (int i = 0; i < b->succs->NumElements(); i++) {
+    List<Phi*> phis;
+    GetPhis(b->succs->Nth(i), &phis);
+    for (int j = 0; j < phis.NumElements(); j++) {
+      List<Location*> *stack = stacks[phiVar[phis.Nth(j)]];
+      phis.Nth(j)->SetArg(b, stack->Nth(stack->NumElements() - 1));
+    }
+  }
+
+  for (int i = 0; i < b->domChildren->NumElements(); i++)
+    Rename(b->domChildren->Nth(i));
+
+  for (int i = 0; i < pushed.NumElements(); i++) {
+    List<Location*> *stack = stacks[pushed.Nth(i)];
+    stack->RemoveAt(stack->NumElements() - 1);
+  }
+}
+
+
+/* Method: Construct
+ * -----------------
+ * Unreachable blocks are dropped first since they are not part of the
+ * dominator tree. If the entry block is a loop header it gets an empty
+ * block in front so the values coming into the function have a
+ * predecessor to flow in from.
+ */
+void SSAForm::Construct()
+{
+  graph->RemoveUnreachableBlocks();
+  if (graph->GetEntry()->preds->NumElements() > 0) {
+    graph->NewBlockBefore(graph->GetEntry());
+    graph->Rebuild();
+  }
+  live = new Liveness(graph);
+  ComputeFrontiers();
+  PlacePhis();
+
+  for (int v = 0; v < live->NumVars(); v++) {
+    stacks.push_back(new List<Location*>);
+    stacks[v]->Append(live->Var(v));
+    versions.push_back(0);
+  }
+  Rename(graph->GetEntry());
+}
+
+
+/* Method: SplitCriticalEdges
+ * --------------------------
+ * An edge from a block with several successors to a block with several
+ * predecessors has no place to put the copies for the phis. A fall
+ * through edge gets an empty block laid out in between, a branch is
+ * redirected to a new labeled block at the end of the function that
+ * jumps on to the original target.
+ */
+void SSAForm::SplitCriticalEdges()
+{
+  List<BasicBlock*> from, to;
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *s = graph->Nth(i);
+    List<Phi*> phis;
+    GetPhis(s, &phis);
+    if (phis.NumElements() == 0 || s->preds->NumElements() < 2) continue;
+    for (int j = 0; j < s->preds->NumElements(); j++) {
+      if (s->preds->Nth(j)->succs->NumElements() < 2) continue;
+      from.Append(s->preds->Nth(j));
+      to.Append(s);
+    }
+  }
+  if (from.NumElements() == 0) return;
+
+  for (int i = 0; i < from.NumElements(); i++) {
+    BasicBlock *p = from.Nth(i), *s = to.Nth(i), *n;
+    Instruction *branch = p->GetLast();
+    if (branch && branch->branch_label() && s->GetLabel()
+        && !strcmp(branch->branch_label(), s->GetLabel())) {
+      n = graph->NewBlockAtEnd();
+      char *label = CodeGenerator::NewLabel();
+      n->code.push_back(new Label(label));
+      n->code.push_back(new Goto(s->GetLabel()));
+      branch->SetBranchLabel(label);
+    } else {
+      n = graph->NewBlockBefore(s);
+    }
+    List<Phi*> phis;
+    GetPhis(s, &phis);
+    for (int j = 0; j < phis.NumElements(); j++)
+      phis.Nth(j)->ReplacePred(p, n);
+  }
+  graph->Rebuild();
+}
+
+void SSAForm::Destruct()
+{
+  SplitCriticalEdges();
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    std::list<Instruction*>::iterator p;
+    for (p = b->code.begin(); p != b->code.end(); ++p) {
+      Phi *phi = dynamic_cast<Phi*>(*p);
+      if (!phi) continue;
+      Location *temp = graph->NewTemp();
+      temp->SetPointer(phi->GetDef()->GetPointer());
+      for (int j = 0; j < phi->NumArgs(); j++)
+        InsertBeforeBranch(phi->GetPred(j), new Assign(temp, phi->GetArg(j)));
+      *p = new Assign(phi->GetDef(), temp);
+    }
+  }
+  graph->Rebuild();
+}
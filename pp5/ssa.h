@@ -0,0 +1,63 @@
+/* File: ssa.h
+ * -----------
+ * The SSAForm class converts the code of one function into static
+ * single assignment form and back. Every definition of a variable in
+ * the stack frame gets a Location of its own (x.1, x.2, ... for x) and
+ * where several definitions reach a block a Phi merges them; the
+ * original Location stands for the value the variable has on entry
+ * (the argument, for a parameter). Phis are placed on the iterated
+ * dominance frontier of the definitions (Cytron et al.), but only
+ * where the variable is live, so no dead phis are created.
+ *
+ * Globals are not renamed: they are gp-relative memory that any call
+ * can read or write, and are treated like the heap by the optimizer.
+ *
+ * Converting back first splits every critical edge into a phi block,
+ * then replaces each phi x = phi(a, b) by a copy t = a (or b) at the
+ * end of each predecessor and x = t at the top of the block. Going
+ * through a fresh temp keeps the copies correct when the phis of a
+ * block depend on each other; the register allocator coalesces most
+ * of the copies away again.
+ */
+
+#ifndef _H_ssa
+#define _H_ssa
+
+#include <map>
+#include <set>
+#include <vector>
+#include "list.h"
+#include "tac.h"
+
+class FlowGraph;
+class BasicBlock;
+class Liveness;
+
+class SSAForm
+{
+  protected:
+    FlowGraph *graph;
+    Liveness *live;
+    std::map<BasicBlock*, std::set<BasicBlock*> > frontier;
+    std::map<Phi*, int> phiVar;               // variable each phi merges
+    std::vector< List<Location*>* > stacks;   // current version of each
+    std::vector<int> versions;
+
+    void ComputeFrontiers();
+    void PlacePhis();
+    void Rename(BasicBlock *b);
+    Location *NewVersion(int var);
+    void SplitCriticalEdges();
+    static void InsertBeforeBranch(BasicBlock *b, Instruction *instr);
+
+  public:
+    SSAForm(FlowGraph *graph);
+
+    void Construct();
+    void Destruct();
+
+         // Returns the phis at the top of b (they follow its label)
+    static void GetPhis(BasicBlock *b, List<Phi*> *phis);
+};
+
+#endif
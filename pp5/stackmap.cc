@@ -0,0 +1,63 @@
+/* File: stackmap.cc
+ * -----------------
+ * Implementation of the stack map passes.
+ */
+
+#include "stackmap.h"
+#include "cfg.h"
+#include "liveness.h"
+#include "codegen.h"
+#include <string.h>
+
+
+bool StackMaps::MayCollect(Instruction *instr)
+{
+  LCall *call = dynamic_cast<LCall*>(instr);
+  if (call)
+    return !CodeGenerator::IsBuiltIn(call->GetLabel()) || !strcmp(call->GetLabel(), "_Alloc");
+  return dynamic_cast<ACall*>(instr) != NULL;
+}
+
+// Parameters come from the caller, so only locals and temps are
+// cleared.
+int StackMaps::ClearUninitialized()
+{
+  Liveness live(graph);
+  BasicBlock *entry = graph->GetEntry();
+  std::list<Instruction*>::iterator p = entry->code.begin();
+  if (entry->GetLabel()) ++p;
+  int cleared = 0;
+  for (int v = 0; v < live.NumVars(); v++) {
+    Location *var = live.Var(v);
+    if (live.LiveIn(entry).Test(v) && var->GetPointer() != notPointer
+        && var->GetOffset() < CodeGenerator::OffsetToFirstParam) {
+      entry->code.insert(p, new LoadConstant(var, 0));
+      cleared++;
+    }
+  }
+  return cleared;
+}
+
+int StackMaps::Record(Liveness *live)
+{
+  int calls = 0;
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    VarSet cur = live->LiveOut(b);
+    std::list<Instruction*>::reverse_iterator p;
+    for (p = b->code.rbegin(); p != b->code.rend(); ++p) {
+      if (MayCollect(*p)) {
+        List<Location*> *roots = new List<Location*>;
+        for (int v = 0; v < live->NumVars(); v++) {
+          Location *var = live->Var(v);
+          if (cur.Test(v) && var != (*p)->GetDef() && var->GetPointer() != notPointer)
+            roots->Append(var);
+        }
+        (*p)->SetRoots(roots);
+        calls++;
+      }
+      live->Transfer(*p, cur);
+    }
+  }
+  return calls;
+}
@@ -0,0 +1,44 @@
+/* File: stackmap.h
+ * ----------------
+ * What the garbage collector needs to know about a function's frame.
+ * The collector (see defs.asm) runs inside _Alloc, so the only points
+ * where it can look at a frame are the calls that may end up there:
+ * calls to Decaf functions and methods and to _Alloc itself, but not
+ * to the other built-ins. For each such call Record lists the pointer
+ * variables live across it (every Location knows whether it holds a
+ * pointer, from the type of the expression or variable it was made
+ * for), and Mips::EmitCallInstr turns the list into a stack map: the
+ * frame slots and callee-saved registers that hold them.
+ *
+ * A local that may be read before it is written would hand the
+ * collector whatever an earlier frame left in its slot, so
+ * ClearUninitialized first sets the pointers live on entry to null.
+ */
+
+#ifndef _H_stackmap
+#define _H_stackmap
+
+#include "tac.h"
+
+class FlowGraph;
+class Liveness;
+
+class StackMaps
+{
+  protected:
+    FlowGraph *graph;
+
+  public:
+    StackMaps(FlowGraph *graph) : graph(graph) {}
+
+    static bool MayCollect(Instruction *instr);
+
+         // Returns the number of variables set to null
+    int ClearUninitialized();
+
+         // Sets the roots of every call that may collect. Returns the
+         // number of calls.
+    int Record(Liveness *live);
+};
+
+#endif
@@ -0,0 +1,214 @@
+/* File: strength.cc
+ * -----------------
+ * Implementation of strength reduction.
+ */
+
+#include "strength.h"
+#include "cfg.h"
+#include "ssa.h"
+#include "codegen.h"
+
+
+LoadConstant *StrengthReduction::ConstantDef(Location *loc)
+{
+  return defs.count(loc) ? dynamic_cast<LoadConstant*>(defs[loc]) : NULL;
+}
+
+/* Method: IsInductionVariable
+ * ---------------------------
+ * Returns true if var is a phi of header that starts at a constant
+ * (returned in init) and grows by a small constant step each time
+ * around the loop.
+ */
+bool StrengthReduction::IsInductionVariable(Location *var, BasicBlock *header,
+                                            BasicBlock *latch, int *init, int *step)
+{
+  Phi *phi = dynamic_cast<Phi*>(defs[var]);
+  if (!phi || defBlock[var] != header || phi->NumArgs() != 2) return false;
+  int in = phi->GetPred(0) == latch ? 0 : 1;
+  if (phi->GetPred(in) != latch) return false;
+  LoadConstant *start = ConstantDef(phi->GetArg(1 - in));
+  BinaryOp *next = dynamic_cast<BinaryOp*>(defs[phi->GetArg(in)]);
+  if (!start || start->GetValue() < -1024 || start->GetValue() > (1 << 20)) return false;
+  if (!next || next->GetCode() != BinaryOp::Add) return false;
+  LoadConstant *c = NULL;
+  if (next->GetOp1() == var) c = ConstantDef(next->GetOp2());
+  else if (next->GetOp2() == var) c = ConstantDef(next->GetOp1());
+  if (!c || c->GetValue() == 0 || c->GetValue() < -16 || c->GetValue() > 16) return false;
+  *init = start->GetValue();
+  *step = c->GetValue();
+  return true;
+}
+
+bool StrengthReduction::IsUsedAsAddress(Location *addr, std::set<BasicBlock*> &body)
+{
+  std::set<BasicBlock*>::iterator b;
+  for (b = body.begin(); b != body.end(); ++b) {
+    std::list<Instruction*>::iterator p;
+    for (p = (*b)->code.begin(); p != (*b)->code.end(); ++p) {
+      Load *load = dynamic_cast<Load*>(*p);
+      Store *store = dynamic_cast<Store*>(*p);
+      if ((load && load->GetSrc() == addr) || (store && store->GetDst() == addr))
+        return true;
+    }
+  }
+  return false;
+}
+
+int StrengthReduction::ReduceLoop(BasicBlock *header)
+{
+  std::set<BasicBlock*> body;
+  if (!graph->LoopBody(header, &body)) return 0;
+  BasicBlock *latch = NULL;
+  for (int i = 0; i < header->preds->NumElements(); i++) {
+    if (!body.count(header->preds->Nth(i))) continue;
+    if (latch) return 0;
+    latch = header->preds->Nth(i);
+  }
+
+  defs.clear();
+  defBlock.clear();
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    std::list<Instruction*>::iterator p;
+    for (p = b->code.begin(); p != b->code.end(); ++p)
+      if ((*p)->GetDef()) {
+        defs[(*p)->GetDef()] = *p;
+        defBlock[(*p)->GetDef()] = b;
+      }
+  }
+
+  List<BinaryOp*> found;
+  List<BasicBlock*> where;
+  List<Location*> bases, indexes;
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    if (!body.count(b) || !graph->Dominates(b, latch)) continue;
+    std::list<Instruction*>::iterator p;
+    for (p = b->code.begin(); p != b->code.end(); ++p) {
+      BinaryOp *add = dynamic_cast<BinaryOp*>(*p);
+      if (!add || add->GetCode() != BinaryOp::Add) continue;
+      for (int side = 0; side < 2; side++) {
+        Location *base = side ? add->GetOp2() : add->GetOp1();
+        Location *offset = side ? add->GetOp1() : add->GetOp2();
+        BinaryOp *mul = dynamic_cast<BinaryOp*>(defs[offset]);
+        if (base->GetSegment() != fpRelative
+            || (defBlock.count(base) && body.count(defBlock[base]))
+            || !mul || mul->GetCode() != BinaryOp::Mul)
+          continue;
+        LoadConstant *k = ConstantDef(mul->GetOp1());
+        Location *index = mul->GetOp2();
+        if (!k) {
+          k = ConstantDef(mul->GetOp2());
+          index = mul->GetOp1();
+        }
+        int init, step;
+        if (!k || k->GetValue() != CodeGenerator::VarSize
+            || !IsInductionVariable(index, header, latch, &init, &step)
+            || !IsUsedAsAddress(add->GetDef(), body))
+          continue;
+        found.Append(add);
+        where.Append(b);
+        bases.Append(base);
+        indexes.Append(index);
+        break;
+      }
+    }
+  }
+  if (found.NumElements() == 0) return 0;
+  BasicBlock *preheader = graph->MakePreheader(header);
+  if (!preheader) return 0;
+
+  std::list<Instruction*>::iterator preEnd = preheader->code.end();
+  if (preheader->GetLast() && preheader->GetLast()->branch_label())
+    --preEnd;
+  std::list<Instruction*>::iterator latchEnd = latch->code.end();
+  if (latch->GetLast() && latch->GetLast()->branch_label())
+    --latchEnd;
+  std::list<Instruction*>::iterator phiEnd = header->code.begin();
+  while (phiEnd != header->code.end()
+         && (dynamic_cast<Label*>(*phiEnd) || dynamic_cast<Phi*>(*phiEnd)))
+    ++phiEnd;
+
+  for (int i = 0; i < found.NumElements(); i++) {
+    int init, step;
+    IsInductionVariable(indexes.Nth(i), header, latch, &init, &step);
+    Location *start = bases.Nth(i), *stride = graph->NewTemp();
+    Location *pointer = graph->NewTemp(), *next = graph->NewTemp();
+    pointer->SetPointer(interiorPointer);
+    next->SetPointer(interiorPointer);
+    if (init != 0) {
+      Location *offset = graph->NewTemp();
+      start = graph->NewTemp();
+      start->SetPointer(interiorPointer);
+      preheader->code.insert(preEnd, new LoadConstant(offset, init * CodeGenerator::VarSize));
+      preheader->code.insert(preEnd, new BinaryOp(BinaryOp::Add, start, bases.Nth(i), offset));
+    }
+    preheader->code.insert(preEnd, new LoadConstant(stride, step * CodeGenerator::VarSize));
+    Phi *phi = new Phi(pointer, header->preds);
+    phi->SetArg(preheader, start);
+    phi->SetArg(latch, next);
+    header->code.insert(phiEnd, phi);
+    latch->code.insert(latchEnd, new BinaryOp(BinaryOp::Add, next, pointer, stride));
+    where.Nth(i)->code.remove(found.Nth(i));
+    for (int j = 0; j < graph->NumBlocks(); j++) {
+      BasicBlock *b = graph->Nth(j);
+      std::list<Instruction*>::iterator p;
+      for (p = b->code.begin(); p != b->code.end(); ++p)
+        (*p)->ReplaceUse(found.Nth(i)->GetDef(), pointer);
+    }
+  }
+  return found.NumElements();
+}
+
+int StrengthReduction::LowerMultiplies()
+{
+  int lowered = 0;
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    std::list<Instruction*>::iterator p;
+    for (p = b->code.begin(); p != b->code.end(); ++p) {
+      BinaryOp *mul = dynamic_cast<BinaryOp*>(*p);
+      if (!mul || mul->GetCode() != BinaryOp::Mul) continue;
+      LoadConstant *k = ConstantDef(mul->GetOp2());
+      Location *other = mul->GetOp1();
+      if (!k) {
+        k = ConstantDef(mul->GetOp1());
+        other = mul->GetOp2();
+      }
+      if (!k || k->GetValue() < 2 || (k->GetValue() & (k->GetValue() - 1))) continue;
+      int shift = 0;
+      while ((1 << shift) != k->GetValue()) shift++;
+      Location *amount = graph->NewTemp();
+      b->code.insert(p, new LoadConstant(amount, shift));
+      *p = new BinaryOp(BinaryOp::ShiftLeft, mul->GetDef(), other, amount);
+      lowered++;
+    }
+  }
+  return lowered;
+}
+
+
+int StrengthReduction::Run()
+{
+  List<BasicBlock*> headers;
+  List<BasicBlock*> *order = graph->ReversePostorder();
+  for (int i = order->NumElements() - 1; i >= 0; i--) {
+    std::set<BasicBlock*> body;
+    if (graph->LoopBody(order->Nth(i), &body))
+      headers.Append(order->Nth(i));
+  }
+
+  int reduced = 0;
+  for (int i = 0; i < headers.NumElements(); i++)
+    reduced += ReduceLoop(headers.Nth(i));
+
+  defs.clear();
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    std::list<Instruction*>::iterator p;
+    for (p = b->code.begin(); p != b->code.end(); ++p)
+      if ((*p)->GetDef()) defs[(*p)->GetDef()] = *p;
+  }
+  return reduced + LowerMultiplies();
+}
@@ -0,0 +1,56 @@
+/* File: strength.h
+ * ----------------
+ * Strength reduction over a function in SSA form.
+ *
+ * Within a loop, an array element address a + 4 * i, where a does not
+ * change in the loop and i is an induction variable (i = phi(init,
+ * i + c) in the header, c a small constant), is replaced by a pointer
+ * of its own: p = phi(a + 4 * init, p + 4 * c). The multiply and the
+ * add leave the loop body for one add per iteration.
+ *
+ * The pointer is stepped at the end of every iteration even when no
+ * element is accessed, and unlike the multiply the add traps on
+ * overflow. So an address is only reduced if it is used by a Load or
+ * Store in a block that runs on every iteration: the element accessed
+ * then exists, and the pointer never gets further than a few words
+ * past the end of the array. init has to be a constant of reasonable
+ * size for the same reason.
+ *
+ * Afterwards each remaining multiply by a power of two becomes a shift
+ * (TAC has no immediate operands, so the amount is loaded as a
+ * constant and the shift is done with sllv).
+ */
+
+#ifndef _H_strength
+#define _H_strength
+
+#include <map>
+#include <set>
+#include "list.h"
+#include "tac.h"
+
+class FlowGraph;
+class BasicBlock;
+
+class StrengthReduction
+{
+  protected:
+    FlowGraph *graph;
+    std::map<Location*, Instruction*> defs;
+    std::map<Location*, BasicBlock*> defBlock;
+
+    LoadConstant *ConstantDef(Location *loc);
+    bool IsInductionVariable(Location *var, BasicBlock *header, BasicBlock *latch,
+                             int *init, int *step);
+    bool IsUsedAsAddress(Location *addr, std::set<BasicBlock*> &body);
+    int ReduceLoop(BasicBlock *header);
+    int LowerMultiplies();
+
+  public:
+    StrengthReduction(FlowGraph *graph) : graph(graph) {}
+
+         // Returns the number of instructions reduced
+    int Run();
+};
+
+#endif
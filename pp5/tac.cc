@@ -5,10 +5,12 @@
   
 #include "tac.h"
 #include "mips.h"
+#include "cfg.h"
 #include <cstring>
+#include <climits>
 
 Location::Location(Segment s, int o, const char *name) :
-  variableName(strdup(name)), segment(s), offset(o), base(NULL) {}
+  variableName(strdup(name)), segment(s), offset(o), base(NULL), pointer(notPointer) {}
 
  
 void Instruction::Print() {
@@ -25,6 +27,9 @@ void Instruction::Emit(Mips *mips) {
 LoadConstant::LoadConstant(Location *d, int v)
   : dst(d), val(v) {
   Assert(dst != NULL);
+  Describe();
+}
+void LoadConstant::Describe() {
   sprintf(printed, "%s = %d", dst->GetName(), val);
 }
 void LoadConstant::EmitSpecific(Mips *mips) {
@@ -38,7 +43,10 @@ LoadStringConstant::LoadStringConstant(Location *d, const char *s)
   const char *quote = (*s == '"') ? "" : "\"";
   str = new char[strlen(s) + 2*strlen(quote) + 1];
   sprintf(str, "%s%s%s", quote, s, quote);
-  quote = (strlen(str) > 50) ? "...\"" : "";
+  Describe();
+}
+void LoadStringConstant::Describe() {
+  const char *quote = (strlen(str) > 50) ? "...\"" : "";
   sprintf(printed, "%s = %.50s%s", dst->GetName(), str, quote);
 }
 void LoadStringConstant::EmitSpecific(Mips *mips) {
@@ -49,6 +57,9 @@ void LoadStringConstant::EmitSpecific(Mips *mips) {
 LoadLabel::LoadLabel(Location *d, const char *l)
   : dst(d), label(strdup(l)) {
   Assert(dst != NULL && label != NULL);
+  Describe();
+}
+void LoadLabel::Describe() {
   sprintf(printed, "%s = %s", dst->GetName(), label);
 }
 void LoadLabel::EmitSpecific(Mips *mips) {
@@ -59,6 +70,9 @@ void LoadLabel::EmitSpecific(Mips *mips) {
 Assign::Assign(Location *d, Location *s)
   : dst(d), src(s) {
   Assert(dst != NULL && src != NULL);
+  Describe();
+}
+void Assign::Describe() {
   sprintf(printed, "%s = %s", dst->GetName(), src->GetName());
 }
 void Assign::EmitSpecific(Mips *mips) {
@@ -66,9 +80,12 @@ void Assign::EmitSpecific(Mips *mips) {
 }
 
 
-Load::Load(Location *d, Location *s, int off)
-  : dst(d), src(s), offset(off) {
+Load::Load(Location *d, Location *s, int off, bool inv)
+  : dst(d), src(s), offset(off), invariant(inv) {
   Assert(dst != NULL && src != NULL);
+  Describe();
+}
+void Load::Describe() {
   if (offset) 
     sprintf(printed, "%s = *(%s + %d)", dst->GetName(), src->GetName(), offset);
   else
@@ -82,6 +99,9 @@ void Load::EmitSpecific(Mips *mips) {
 Store::Store(Location *d, Location *s, int off)
   : dst(d), src(s), offset(off) {
   Assert(dst != NULL && src != NULL);
+  Describe();
+}
+void Store::Describe() {
   if (offset)
     sprintf(printed, "*(%s + %d) = %s", dst->GetName(), offset, src->GetName());
   else
@@ -92,7 +112,7 @@ void Store::EmitSpecific(Mips *mips) {
 }
 
  
-const char * const BinaryOp::opName[BinaryOp::NumOps]  = {"+", "-", "*", "/", "%", "==", "<", "&&", "||"};;
+const char * const BinaryOp::opName[BinaryOp::NumOps]  = {"+", "-", "*", "/", "%", "==", "<", "&&", "||", "<<"};
 
 BinaryOp::OpCode BinaryOp::OpCodeForName(const char *name) {
   for (int i = 0; i < NumOps; i++) 
@@ -102,10 +122,39 @@ BinaryOp::OpCode BinaryOp::OpCodeForName(const char *name) {
   return Add; // can't get here, but compiler doesn't know that
 }
 
+// Folding must agree with the MIPS instructions: add and sub trap on
+// overflow (so those are left for runtime), mul and shifts wrap, and/or
+// are bitwise.
+bool BinaryOp::Evaluate(OpCode c, int a, int b, int *result) {
+  long long wide;
+  switch (c) {
+    case Add:  wide = (long long)a + b; break;
+    case Sub:  wide = (long long)a - b; break;
+    case Mul:  *result = (int)((unsigned)a * (unsigned)b); return true;
+    case Div:  if (b == 0 || (b == -1 && a == INT_MIN)) return false;
+	       *result = a / b; return true;
+    case Mod:  if (b == 0 || (b == -1 && a == INT_MIN)) return false;
+	       *result = a % b; return true;
+    case Eq:   *result = (a == b); return true;
+    case Less: *result = (a < b); return true;
+    case And:  *result = a & b; return true;
+    case Or:   *result = a | b; return true;
+    case ShiftLeft: if (b < 0 || b > 31) return false;
+	       *result = (int)((unsigned)a << b); return true;
+    default:   return false;
+  }
+  if (wide < INT_MIN || wide > INT_MAX) return false;
+  *result = (int)wide;
+  return true;
+}
+
 BinaryOp::BinaryOp(OpCode c, Location *d, Location *o1, Location *o2)
   : code(c), dst(d), op1(o1), op2(o2) {
   Assert(dst != NULL && op1 != NULL && op2 != NULL);
   Assert(code >= 0 && code < NumOps);
+  Describe();
+}
+void BinaryOp::Describe() {
   sprintf(printed, "%s = %s %s %s", dst->GetName(), op1->GetName(), opName[code], op2->GetName());
 }
 void BinaryOp::EmitSpecific(Mips *mips) {	  
@@ -125,6 +174,9 @@ void Label::EmitSpecific(Mips *mips) {
  
 Goto::Goto(const char *l) : label(strdup(l)) {
   Assert(label != NULL);
+  Describe();
+}
+void Goto::Describe() {
   sprintf(printed, "Goto %s", label);
 }
 void Goto::EmitSpecific(Mips *mips) {	  
@@ -134,45 +186,114 @@ void Goto::EmitSpecific(Mips *mips) {
 IfZ::IfZ(Location *te, const char *l)
    : test(te), label(strdup(l)) {
   Assert(test != NULL && label != NULL);
+  Describe();
+}
+void IfZ::Describe() {
   sprintf(printed, "IfZ %s Goto %s", test->GetName(), label);
 }
 void IfZ::EmitSpecific(Mips *mips) {	  
   mips->EmitIfZ(test, label);
 }
 
+const char * const IfCompare::relationName[IfCompare::NumRelations] = {"<", "<=", ">", ">=", "==", "!="};
+
+IfCompare::Relation IfCompare::RelationForName(const char *name) {
+  for (int i = 0; i < NumRelations; i++)
+    if (!strcmp(relationName[i], name))
+	return (Relation)i;
+  Failure("Unrecognized Tac relation: '%s'\n", name);
+  return Less;
+}
+IfCompare::Relation IfCompare::Negate(Relation r) {
+  static const Relation negated[NumRelations] = {GreaterEq, Greater, LessEq, Less, NotEqual, Equal};
+  return negated[r];
+}
+IfCompare::Relation IfCompare::Swap(Relation r) {
+  static const Relation swapped[NumRelations] = {Greater, GreaterEq, Less, LessEq, Equal, NotEqual};
+  return swapped[r];
+}
+bool IfCompare::Evaluate(Relation r, int a, int b) {
+  switch (r) {
+    case Less:      return a < b;
+    case LessEq:    return a <= b;
+    case Greater:   return a > b;
+    case GreaterEq: return a >= b;
+    case Equal:     return a == b;
+    default:        return a != b;
+  }
+}
+
+IfCompare::IfCompare(Relation r, Location *o1, Location *o2, const char *l)
+  : relation(r), op1(o1), op2(o2), label(strdup(l)) {
+  Assert(op1 != NULL && op2 != NULL && label != NULL);
+  Describe();
+}
+void IfCompare::Describe() {
+  sprintf(printed, "If %s %s %s Goto %s", op1->GetName(), relationName[relation],
+	  op2->GetName(), label);
+}
+void IfCompare::EmitSpecific(Mips *mips) {
+  mips->EmitIfCompare(relation, op1, op2, label);
+}
+
 BeginFunc::BeginFunc() {
   sprintf(printed,"BeginFunc (unassigned)");
   frameSize = -555; // used as sentinel to recognized unassigned value
+  registers = NULL;
+  isLeaf = false;
+  savesRA = true;
+  numParams = 0;
 }
 void BeginFunc::SetFrameSize(int numBytesForAllLocalsAndTemps) {
   frameSize = numBytesForAllLocalsAndTemps; 
   sprintf(printed,"BeginFunc %d", frameSize);
 }
 void BeginFunc::EmitSpecific(Mips *mips) {
-  mips->EmitBeginFunction(frameSize);
+  mips->EmitBeginFunction(frameSize, registers, savesRA, isLeaf, numParams);
+}
+
+SaveRA::SaveRA() {
+  sprintf(printed, "SaveRA");
+}
+void SaveRA::EmitSpecific(Mips *mips) {
+  mips->EmitSaveRA();
 }
 
-EndFunc::EndFunc() : Instruction() {
+EndFunc::EndFunc() : Instruction(), restoresRA(true) {
   sprintf(printed, "EndFunc");
 }
 void EndFunc::EmitSpecific(Mips *mips) {
-  mips->EmitEndFunction();
+  mips->EmitEndFunction(restoresRA);
 }
  
-Return::Return(Location *v) : val(v) {
+Return::Return(Location *v) : val(v), restoresRA(true) {
+  Describe();
+}
+void Return::Describe() {
   sprintf(printed, "Return %s", val? val->GetName() : "");
 }
 void Return::EmitSpecific(Mips *mips) {	  
-  mips->EmitReturn(val);
+  mips->EmitReturn(val, restoresRA);
+}
+
+TailCall::TailCall(const char *l, int n)
+  : Return(NULL), label(strdup(l)), numBytes(n) {
+  sprintf(printed, "TailCall %s %d", label, numBytes);
+}
+void TailCall::EmitSpecific(Mips *mips) {
+  mips->EmitTailCall(label, numBytes, restoresRA);
 }
 
 PushParam::PushParam(Location *p)
-  :  param(p) {
+  :  param(p), index(-1), count(-1) {
   Assert(param != NULL);
+  Describe();
+}
+void PushParam::Describe() {
   sprintf(printed, "PushParam %s", param->GetName());
 }
 void PushParam::EmitSpecific(Mips *mips) {
-  mips->EmitParam(param);
+  mips->EmitParam(param, index, count);
 } 
 
 PopParams::PopParams(int nb)
@@ -186,15 +307,45 @@ void PopParams::EmitSpecific(Mips *mips) {
 
 LCall::LCall(const char *l, Location *d)
   :  label(strdup(l)), dst(d) {
+  Describe();
+}
+void LCall::Describe() {
   sprintf(printed, "%s%sLCall %s", dst? dst->GetName(): "", dst?" = ":"", label);
 }
 void LCall::EmitSpecific(Mips *mips) {
   mips->EmitLCall(dst, label);
 }
 
+Allocate::Allocate(Location *d, Location *b, int k)
+  : dst(d), bytes(b), kind(k) {
+  Assert(dst != NULL && bytes != NULL);
+  Describe();
+}
+void Allocate::Describe() {
+  sprintf(printed, "%s = Allocate %s (kind %d)", dst->GetName(), bytes->GetName(), kind);
+}
+void Allocate::EmitSpecific(Mips *mips) {
+  Assert(0); // expanded before the flow graph is linearized
+}
+
+StackBlock::StackBlock(Location *d, int b, int h)
+  : dst(d), bytes(b), header(h), offset(0) {
+  Assert(dst != NULL);
+  Describe();
+}
+void StackBlock::Describe() {
+  sprintf(printed, "%s = StackBlock %d", dst->GetName(), bytes);
+}
+void StackBlock::EmitSpecific(Mips *mips) {
+  mips->EmitStackBlock(dst, offset, bytes, header);
+}
+
 ACall::ACall(Location *ma, Location *d)
   : dst(d), methodAddr(ma) {
   Assert(methodAddr != NULL);
+  Describe();
+}
+void ACall::Describe() {
   sprintf(printed, "%s%sACall %s", dst? dst->GetName(): "", dst?" = ":"",
 	    methodAddr->GetName());
 }
@@ -202,9 +353,60 @@ void ACall::EmitSpecific(Mips *mips) {
   mips->EmitACall(dst, methodAddr);
 } 
 
-VTable::VTable(const char *l, List<const char *> *m)
-  : methodLabels(m), label(strdup(l)) {
-  Assert(methodLabels != NULL && label != NULL);
+Phi::Phi(Location *d, List<BasicBlock*> *p)
+  : dst(d) {
+  Assert(dst != NULL && p != NULL);
+  preds = new List<BasicBlock*>;
+  args = new List<Location*>;
+  for (int i = 0; i < p->NumElements(); i++) {
+    preds->Append(p->Nth(i));
+    args->Append(NULL);
+  }
+  *printed = '\0';
+}
+void Phi::Print() {
+  printf("\t%s = phi(", dst->GetName());
+  for (int i = 0; i < args->NumElements(); i++)
+    printf("%s%s:B%d", i ? ", " : "", args->Nth(i) ? args->Nth(i)->GetName() : "?",
+	   preds->Nth(i)->id);
+  printf(") ;\n");
+}
+void Phi::EmitSpecific(Mips *mips) {
+  Failure("Phi for %s left in code at final code generation", dst->GetName());
+}
+void Phi::GetUses(List<Location*> *uses) {
+  for (int i = 0; i < args->NumElements(); i++)
+    if (args->Nth(i)) uses->Append(args->Nth(i));
+}
+void Phi::ReplaceUse(Location *from, Location *to) {
+  for (int i = 0; i < args->NumElements(); i++)
+    if (args->Nth(i) == from) SetArg(preds->Nth(i), to);
+}
+void Phi::SetArg(BasicBlock *pred, Location *arg) {
+  for (int i = 0; i < preds->NumElements(); i++)
+    if (preds->Nth(i) == pred) {
+      args->RemoveAt(i);
+      args->InsertAt(arg, i);
+    }
+}
+void Phi::ReplacePred(BasicBlock *from, BasicBlock *to) {
+  for (int i = 0; i < preds->NumElements(); i++)
+    if (preds->Nth(i) == from) {
+      preds->RemoveAt(i);
+      preds->InsertAt(to, i);
+    }
+}
+void Phi::RemovePred(BasicBlock *pred) {
+  for (int i = 0; i < preds->NumElements(); i++)
+    if (preds->Nth(i) == pred) {
+      preds->RemoveAt(i);
+      args->RemoveAt(i--);
+    }
+}
+
+VTable::VTable(const char *l, List<const char *> *m, List<int> *f)
+  : methodLabels(m), pointerFields(f), label(strdup(l)) {
+  Assert(methodLabels != NULL && pointerFields != NULL && label != NULL);
   sprintf(printed, "VTable for class %s", l);
 }
 
@@ -215,5 +417,5 @@ void VTable::Print() {
   printf("; \n"); 
 }
 void VTable::EmitSpecific(Mips *mips) {
-  mips->EmitVTable(label, methodLabels);
+  mips->EmitVTable(label, methodLabels, pointerFields);
 }
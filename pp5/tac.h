@@ -23,6 +23,7 @@
 #ifndef _H_tac
 #define _H_tac
 
+#include <map>
 #include "list.h" // for VTable
 class Mips;
 
@@ -37,6 +38,15 @@ class Mips;
  
 typedef enum {fpRelative, gpRelative} Segment;
 
+    // What a Location holds as far as the garbage collector cares: a
+    // pointer to an object, a pointer to an array (to its first
+    // element, the length is in the word before it), or one into the
+    // middle of an array (an element address). The same codes appear
+    // in the stack maps and in the header of an array, for the kind of
+    // its elements (see defs.asm).
+
+typedef enum {notPointer, objectPointer, arrayPointer, interiorPointer} PointerKind;
+
 class Location
 {
   protected:
@@ -44,6 +54,7 @@ class Location
     Segment segment;
     int offset;
     Location* base;
+    PointerKind pointer;
 	  
   public:
     Location(Segment seg, int offset, const char *name);
@@ -51,22 +62,52 @@ class Location
     const char *GetName() const     { return variableName; }
     Segment GetSegment() const      { return segment; }
     int GetOffset() const           { return offset; }
+    void SetOffset(int o)           { offset = o; }  // when frame is repacked
     Location* GetBase() const       { return base; }
+    PointerKind GetPointer() const  { return pointer; }
+    void SetPointer(PointerKind p)  { pointer = p; }
 };
  
 
 
   // base class from which all Tac instructions derived
   // has the interface for the 2 polymorphic messages: Print & Emit
+  // GetDef and GetUses describe the operands for the optimizer:
+  // the location written (NULL if none) and the locations read,
+  // SetDef and ReplaceUse change them.
+  // The dead-after list names the operands whose values are no longer
+  // needed once the instruction is done, so the Mips register cache
+  // can drop them without storing them. The roots of a call that may
+  // collect garbage are the pointers live across it (see stackmap.h).
   
 class Instruction {
     protected:
       char printed[128];
+      List<Location*> *deadAfter;
+      List<Location*> *roots;
 	  
     public:
+	Instruction() : deadAfter(NULL), roots(NULL) {}
 	virtual void Print();
 	virtual void EmitSpecific(Mips *mips) = 0;
 	void Emit(Mips *mips);
+
+	virtual Location *GetDef() { return NULL; }
+	virtual void GetUses(List<Location*> *uses) {}
+	virtual bool IsCall() { return false; }
+
+	// rewrite the operands (SSA renaming, propagation passes)
+	virtual void SetDef(Location *dst) { Assert(0); }
+	virtual void ReplaceUse(Location *from, Location *to) {}
+
+	// the label a Goto or conditional branch jumps to, NULL otherwise
+	virtual const char* branch_label() const { return NULL; }
+	virtual void SetBranchLabel(const char *l) { Assert(0); }
+
+	void SetDeadAfter(List<Location*> *dead) { deadAfter = dead; }
+	List<Location*> *GetDeadAfter() { return deadAfter; }
+	void SetRoots(List<Location*> *r) { roots = r; }
+	List<Location*> *GetRoots() { return roots; }
 };
 
   
@@ -84,77 +125,135 @@ class Instruction {
   class Label;
   class Goto;
   class IfZ;
+  class IfCompare;
   class BeginFunc;
   class EndFunc;
+  class SaveRA;
   class Return;
+  class TailCall;
   class PushParam;
   class PopParams;
   class LCall;
   class ACall;
+  class Allocate;
+  class StackBlock;
   class VTable;
+  class Phi;
+
+class BasicBlock;
 
 
 
 class LoadConstant: public Instruction {
     Location *dst;
     int val;
+    void Describe();
   public:
     LoadConstant(Location *dst, int val);
     void EmitSpecific(Mips *mips);
+    int GetValue() { return val; }
+    Location *GetDef() { return dst; }
+    void SetDef(Location *d) { dst = d; Describe(); }
 };
 
 class LoadStringConstant: public Instruction {
     Location *dst;
     char *str;
+    void Describe();
   public:
     LoadStringConstant(Location *dst, const char *s);
     void EmitSpecific(Mips *mips);
+    Location *GetDef() { return dst; }
+    void SetDef(Location *d) { dst = d; Describe(); }
 };
     
 class LoadLabel: public Instruction {
     Location *dst;
     const char *label;
+    void Describe();
   public:
     LoadLabel(Location *dst, const char *label);
     void EmitSpecific(Mips *mips);
+    const char *GetLabel() { return label; }
+    Location *GetDef() { return dst; }
+    void SetDef(Location *d) { dst = d; Describe(); }
 };
 
 class Assign: public Instruction {
     Location *dst, *src;
+    void Describe();
   public:
     Assign(Location *dst, Location *src);
     void EmitSpecific(Mips *mips);
+    Location *GetDef() { return dst; }
+    void GetUses(List<Location*> *uses) { uses->Append(src); }
+    Location *GetSrc() { return src; }
+    void SetDef(Location *d) { dst = d; Describe(); }
+    void ReplaceUse(Location *from, Location *to)
+      { if (src == from) src = to; Describe(); }
 };
 
 class Load: public Instruction {
     Location *dst, *src;
     int offset;
+    bool invariant;
+    void Describe();
   public:
-    Load(Location *dst, Location *src, int offset = 0);
+    Load(Location *dst, Location *src, int offset = 0, bool invariant = false);
     void EmitSpecific(Mips *mips);
+    Location *GetSrc() { return src; }
+    int GetOffset() { return offset; }
+    // true if no Store can change the word once it can be loaded
+    bool IsInvariant() { return invariant; }
+    Location *GetDef() { return dst; }
+    void GetUses(List<Location*> *uses) { uses->Append(src); }
+    void SetDef(Location *d) { dst = d; Describe(); }
+    void ReplaceUse(Location *from, Location *to)
+      { if (src == from) src = to; Describe(); }
 };
 
 class Store: public Instruction {
     Location *dst, *src;
     int offset;
+    void Describe();
   public:
     Store(Location *d, Location *s, int offset = 0);
     void EmitSpecific(Mips *mips);
+    Location *GetDst() { return dst; }
+    Location *GetSrc() { return src; }
+    int GetOffset() { return offset; }
+    void GetUses(List<Location*> *uses) { uses->Append(dst); uses->Append(src); }
+    void ReplaceUse(Location *from, Location *to)
+      { if (dst == from) dst = to; if (src == from) src = to; Describe(); }
 };
 
 class BinaryOp: public Instruction {
 
   public:
-    typedef enum {Add, Sub, Mul, Div, Mod, Eq, Less, And, Or, NumOps} OpCode;
+    typedef enum {Add, Sub, Mul, Div, Mod, Eq, Less, And, Or, ShiftLeft, NumOps} OpCode;
     static const char * const opName[NumOps];
     static OpCode OpCodeForName(const char *name);
     
   protected:
     OpCode code;
     Location *dst, *op1, *op2;
+    void Describe();
   public:
     BinaryOp(OpCode c, Location *dst, Location *op1, Location *op2);
     void EmitSpecific(Mips *mips);
+    OpCode GetCode() { return code; }
+    Location *GetOp1() { return op1; }
+    Location *GetOp2() { return op2; }
+    static bool IsCommutative(OpCode c)
+      { return c == Add || c == Mul || c == Eq || c == And || c == Or; }
+         // computes the result for constant operands, false if it can't
+         // be done at compile time (division by zero traps at runtime)
+    static bool Evaluate(OpCode c, int a, int b, int *result);
+    Location *GetDef() { return dst; }
+    void GetUses(List<Location*> *uses) { uses->Append(op1); uses->Append(op2); }
+    void SetDef(Location *d) { dst = d; Describe(); }
+    void ReplaceUse(Location *from, Location *to)
+      { if (op1 == from) op1 = to; if (op2 == from) op2 = to; Describe(); }
 };
 
 class Label: public Instruction {
@@ -168,48 +267,144 @@ class Label: public Instruction {
 
 class Goto: public Instruction {
     const char *label;
+    void Describe();
   public:
     Goto(const char *label);
     void EmitSpecific(Mips *mips);
     const char* branch_label() const { return label; }
+    void SetBranchLabel(const char *l) { label = l; Describe(); }
 };
 
 class IfZ: public Instruction {
     Location *test;
     const char *label;
+    void Describe();
   public:
     IfZ(Location *test, const char *label);
     void EmitSpecific(Mips *mips);
+    Location *GetTest() { return test; }
+    void GetUses(List<Location*> *uses) { uses->Append(test); }
+    const char* branch_label() const { return label; }
+    void SetBranchLabel(const char *l) { label = l; Describe(); }
+    void ReplaceUse(Location *from, Location *to)
+      { if (test == from) test = to; Describe(); }
+};
+
+  // jumps to label if op1 relation op2 holds, falls through otherwise
+class IfCompare: public Instruction {
+
+  public:
+    typedef enum {Less, LessEq, Greater, GreaterEq, Equal, NotEqual, NumRelations} Relation;
+    static const char * const relationName[NumRelations];
+    static Relation RelationForName(const char *name);
+    static Relation Negate(Relation r);       // !(a r b) is a Negate(r) b
+    static Relation Swap(Relation r);         // a r b is b Swap(r) a
+    static bool Evaluate(Relation r, int a, int b);
+
+  protected:
+    Relation relation;
+    Location *op1, *op2;
+    const char *label;
+    void Describe();
+  public:
+    IfCompare(Relation r, Location *op1, Location *op2, const char *label);
+    void EmitSpecific(Mips *mips);
+    Relation GetRelation() { return relation; }
+    Location *GetOp1() { return op1; }
+    Location *GetOp2() { return op2; }
+    void GetUses(List<Location*> *uses) { uses->Append(op1); uses->Append(op2); }
     const char* branch_label() const { return label; }
+    void SetBranchLabel(const char *l) { label = l; Describe(); }
+    void ReplaceUse(Location *from, Location *to)
+      { if (op1 == from) op1 = to; if (op2 == from) op2 = to; Describe(); }
 };
 
 class BeginFunc: public Instruction {
     int frameSize;
+    std::map<Location*, int> *registers;
+    bool isLeaf, savesRA;
+    int numParams;
   public:
     BeginFunc();
     // used to backpatch the instruction with frame size once known
     void SetFrameSize(int numBytesForAllLocalsAndTemps);
+    int GetFrameSize() { return frameSize; }
+    // register (a Mips::Register) chosen for each variable kept in one
+    void SetRegisters(std::map<Location*, int> *r) { registers = r; }
+    // a leaf makes no calls and pushes nothing; the prologue saves $ra
+    // unless every call has a SaveRA of its own (see shrinkwrap.h)
+    void SetLeaf(bool leaf) { isLeaf = leaf; }
+    bool IsLeaf() { return isLeaf; }
+    void SetSavesRA(bool saves) { savesRA = saves; }
+    // this and the formals, which come in $a0-$a3 under the register
+    // calling convention (see Mips::EmitParam)
+    void SetNumParams(int n) { numParams = n; }
+    void EmitSpecific(Mips *mips);
+};
+
+  // Saves $ra in its slot of the frame, on the paths to calls when
+  // the prologue doesn't
+class SaveRA: public Instruction {
+  public:
+    SaveRA();
     void EmitSpecific(Mips *mips);
 };
 
 class EndFunc: public Instruction {
+    bool restoresRA;
   public:
     EndFunc();
+    // false if $ra was never saved on the way to the end of the body
+    void SetRestoresRA(bool restores) { restoresRA = restores; }
     void EmitSpecific(Mips *mips);
 };
 
 class Return: public Instruction {
     Location *val;
+    void Describe();
+  protected:
+    bool restoresRA;
   public:
     Return(Location *val);
     void EmitSpecific(Mips *mips);
+    // false if $ra was never saved on the way to this return
+    void SetRestoresRA(bool restores) { restoresRA = restores; }
+    Location *GetValue() { return val; }
+    void GetUses(List<Location*> *uses) { if (val) uses->Append(val); }
+    void ReplaceUse(Location *from, Location *to)
+      { if (val == from) val = to; Describe(); }
 };   
 
+  // A call right before a return, made in the frame of the function
+  // making it (see tailcall.h): the pushed arguments are copied over
+  // the function's own, its frame is popped and the callee returns
+  // straight to our caller. Like a Return, it leaves the function.
+class TailCall: public Return {
+    const char *label;
+    int numBytes;
+  public:
+    TailCall(const char *label, int numBytesOfParams);
+    void EmitSpecific(Mips *mips);
+    const char *GetLabel() { return label; }
+    int GetNumBytes() { return numBytes; }
+    bool IsCall() { return true; }
+};
+
 class PushParam: public Instruction {
     Location *param;
+    int index, count;
+    void Describe();
   public:
     PushParam(Location *param);
     void EmitSpecific(Mips *mips);
+    Location *GetParam() { return param; }
+    // which of the count arguments of the call this is (the first is
+    // pushed last), once known; the register calling convention
+    // needs it
+    void SetArgument(int i, int n) { index = i; count = n; }
+    void GetUses(List<Location*> *uses) { uses->Append(param); }
+    void ReplaceUse(Location *from, Location *to)
+      { if (param == from) param = to; Describe(); }
 }; 
 
 class PopParams: public Instruction {
@@ -217,28 +412,108 @@ class PopParams: public Instruction {
   public:
     PopParams(int numBytesOfParamsToRemove);
     void EmitSpecific(Mips *mips);
+    int GetNumBytes() { return numBytes; }
 }; 
 
 class LCall: public Instruction {
     const char *label;
     Location *dst;
+    void Describe();
   public:
     LCall(const char *labe, Location *result);
     void EmitSpecific(Mips *mips);
+    const char *GetLabel() { return label; }
+    Location *GetDef() { return dst; }
+    bool IsCall() { return true; }
+    void SetDef(Location *d) { dst = d; Describe(); }
 };
 
 class ACall: public Instruction {
     Location *dst, *methodAddr;
+    void Describe();
   public:
     ACall(Location *meth, Location *result);
     void EmitSpecific(Mips *mips);
+    Location *GetDef() { return dst; }
+    void GetUses(List<Location*> *uses) { uses->Append(methodAddr); }
+    bool IsCall() { return true; }
+    void SetDef(Location *d) { dst = d; Describe(); }
+    void ReplaceUse(Location *from, Location *to)
+      { if (methodAddr == from) methodAddr = to; Describe(); }
+};
+
+  // Allocates bytes of zeroed memory and gives their address, with a
+  // header for the collector (kind is the header's low bits, see
+  // CodeGenerator::GenAlloc) in the word before. It only lives until
+  // the flow graph is built: escape analysis may turn it into a
+  // StackBlock, and CodeGenerator::ExpandAllocs turns the rest into
+  // the inline allocation from the heap.
+class Allocate: public Instruction {
+    Location *dst, *bytes;
+    int kind;
+    void Describe();
+  public:
+    Allocate(Location *dst, Location *bytes, int kind);
+    void EmitSpecific(Mips *mips);
+    Location *GetBytes() { return bytes; }
+    int GetKind() { return kind; }
+    Location *GetDef() { return dst; }
+    void GetUses(List<Location*> *uses) { uses->Append(bytes); }
+    void SetDef(Location *d) { dst = d; Describe(); }
+    void ReplaceUse(Location *from, Location *to)
+      { if (bytes == from) bytes = to; Describe(); }
+};
+
+  // An allocation that never escapes the function, placed in its frame
+  // instead (see escape.h). The block is cleared and given the same
+  // header as on the heap each time; offset is where the block starts,
+  // set once the frame is laid out.
+class StackBlock: public Instruction {
+    Location *dst;
+    int bytes, header, offset;
+    void Describe();
+  public:
+    StackBlock(Location *dst, int bytes, int header);
+    void EmitSpecific(Mips *mips);
+    int GetBytes() { return bytes; }    // header included
+    void SetOffset(int o) { offset = o; }
+    Location *GetDef() { return dst; }
+    void SetDef(Location *d) { dst = d; Describe(); }
+};
+
+  // A Phi only appears while a function is in SSA form (see ssa.h). It
+  // selects the argument that belongs to the predecessor block control
+  // came from; all phis at the top of a block take effect at once.
+class Phi: public Instruction {
+    Location *dst;
+    List<Location*> *args;          // one argument per predecessor,
+    List<BasicBlock*> *preds;       // in the same order
+  public:
+    Phi(Location *dst, List<BasicBlock*> *preds);
+    void Print();
+    void EmitSpecific(Mips *mips);
+    Location *GetDef() { return dst; }
+    void GetUses(List<Location*> *uses);
+    void SetDef(Location *d) { dst = d; }
+    void ReplaceUse(Location *from, Location *to);
+
+    int NumArgs() { return args->NumElements(); }
+    Location *GetArg(int i) { return args->Nth(i); }
+    BasicBlock *GetPred(int i) { return preds->Nth(i); }
+    void SetArg(BasicBlock *pred, Location *arg);
+    void ReplacePred(BasicBlock *from, BasicBlock *to);
+    void RemovePred(BasicBlock *pred);
 };
 
 class VTable: public Instruction {
     List<const char *> *methodLabels;
+    List<int> *pointerFields;
     const char *label;
  public:
-    VTable(const char *labelForTable, List<const char *> *methodLabels);
+         // pointerFields gives the offset of each pointer field of the
+         // class, plus its PointerKind
+    VTable(const char *labelForTable, List<const char *> *methodLabels,
+           List<int> *pointerFields);
     void Print();
     void EmitSpecific(Mips *mips);
 };
@@ -0,0 +1,182 @@
+/* File: tailcall.cc
+ * -----------------
+ * Implementation of the tail call passes.
+ */
+
+#include "tailcall.h"
+#include "cfg.h"
+#include "codegen.h"
+#include <string.h>
+#include <map>
+
+
+/* Method: Match
+ * -------------
+ * Returns the last LCall of b if it is in tail position, else NULL.
+ * After its PopParams the result may still be copied around, and
+ * control may go through Gotos and into the next block, on its way
+ * to a Return of it (or of nothing, or off the end of the body), as
+ * the phis of SSA form and inlining leave it. first is left on the
+ * first of the PushParams before the call, and numBytes is set to the
+ * size of the arguments.
+ */
+LCall *TailCalls::Match(BasicBlock *b, std::list<Instruction*>::iterator &first,
+                        int *numBytes)
+{
+  std::list<Instruction*>::iterator p;
+  first = b->code.end();
+  for (p = b->code.begin(); p != b->code.end(); ++p)
+    if (dynamic_cast<LCall*>(*p)) first = p;
+  if (first == b->code.end() || !dynamic_cast<LCall*>(*first)) return NULL;
+  LCall *call = dynamic_cast<LCall*>(*first);
+  if (!strcmp(call->GetLabel(), "_Halt")) return NULL;
+
+  // no PopParams follows a call without arguments
+  p = first;
+  PopParams *pop = ++p == b->code.end() ? NULL : dynamic_cast<PopParams*>(*p);
+  if (pop) ++p;
+  *numBytes = pop ? pop->GetNumBytes() : 0;
+
+  Location *result = call->GetDef();
+  BasicBlock *cur = b;
+  bool returns = false;
+  for (int steps = 0; steps < MaxSteps && !returns; steps++) {
+    if (p == cur->code.end()) {
+      if (cur->succs->NumElements() != 1) return NULL;
+      cur = cur->succs->Nth(0);
+      returns = (cur == graph->GetExit());
+      p = cur->code.begin();
+      continue;
+    }
+    Assign *copy = dynamic_cast<Assign*>(*p);
+    Return *ret = dynamic_cast<Return*>(*p);
+    if (dynamic_cast<Label*>(*p)) {
+      ++p;
+    } else if (copy && result && copy->GetSrc() == result
+               && copy->GetDef()->GetSegment() == fpRelative) {
+      result = copy->GetDef();
+      ++p;
+    } else if (dynamic_cast<Goto*>(*p)) {
+      p = cur->code.end();
+    } else if (ret && !dynamic_cast<TailCall*>(ret)
+               && (!ret->GetValue() || ret->GetValue() == result)) {
+      returns = true;
+    } else {
+      return NULL;
+    }
+  }
+  if (!returns) return NULL;
+
+  for (int k = 0; k < *numBytes / CodeGenerator::VarSize; k++)
+    if (first == b->code.begin() || !dynamic_cast<PushParam*>(*--first))
+      return NULL;
+  return call;
+}
+
+/* Method: RemoveRecursion
+ * -----------------------
+ * The parameters are found by their offsets in the frame. The top of
+ * the body gets a label, and a new empty entry block is put before it
+ * so that the jumps back to it form a loop like any other.
+ */
+int TailCalls::RemoveRecursion()
+{
+  std::map<int, Location*> params;
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    std::list<Instruction*>::iterator p;
+    for (p = b->code.begin(); p != b->code.end(); ++p) {
+      List<Location*> used;
+      (*p)->GetUses(&used);
+      if ((*p)->GetDef()) used.Append((*p)->GetDef());
+      for (int j = 0; j < used.NumElements(); j++) {
+        Location *loc = used.Nth(j);
+        if (loc->GetSegment() != fpRelative
+            || loc->GetOffset() < CodeGenerator::OffsetToFirstParam)
+          continue;
+        if (params.count(loc->GetOffset()) && params[loc->GetOffset()] != loc)
+          return 0;
+        params[loc->GetOffset()] = loc;
+      }
+    }
+  }
+
+  BasicBlock *top = graph->GetEntry();
+  const char *entry = NULL;
+  int removed = 0;
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    std::list<Instruction*>::iterator first;
+    int numBytes;
+    LCall *call = Match(b, first, &numBytes);
+    if (!call || strcmp(call->GetLabel(), graph->GetName())) continue;
+    if (!entry && !(entry = top->GetLabel())) {
+      entry = CodeGenerator::NewLabel();
+      top->code.push_front(new Label(entry));
+    }
+
+    // all arguments are read before any parameter is overwritten
+    std::list<Instruction*> loop, assigns;
+    int numArgs = numBytes / CodeGenerator::VarSize;
+    std::list<Instruction*>::iterator p = first;
+    for (int j = numArgs - 1; j >= 0; j--, ++p) {
+      int offset = CodeGenerator::OffsetToFirstParam + j * CodeGenerator::VarSize;
+      if (!params.count(offset)) continue;    // a parameter never used
+      Location *temp = graph->NewTemp();
+      temp->SetPointer(params[offset]->GetPointer());
+      loop.push_back(new Assign(temp, dynamic_cast<PushParam*>(*p)->GetParam()));
+      assigns.push_back(new Assign(params[offset], temp));
+    }
+    loop.splice(loop.end(), assigns);
+    loop.push_back(new Goto(entry));
+    b->code.erase(first, b->code.end());
+    b->code.splice(b->code.end(), loop);
+    removed++;
+  }
+
+  if (removed > 0) {
+    graph->NewBlockBefore(top);
+    graph->Rebuild();
+    graph->RemoveUnreachableBlocks();
+  }
+  return removed;
+}
+
+int TailCalls::ReuseFrames()
+{
+  int paramBytes = 0;
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    std::list<Instruction*>::iterator p;
+    for (p = b->code.begin(); p != b->code.end(); ++p) {
+      List<Location*> used;
+      (*p)->GetUses(&used);
+      if ((*p)->GetDef()) used.Append((*p)->GetDef());
+      for (int j = 0; j < used.NumElements(); j++) {
+        Location *loc = used.Nth(j);
+        int end = loc->GetOffset() - CodeGenerator::OffsetToFirstParam + CodeGenerator::VarSize;
+        if (loc->GetSegment() == fpRelative && end > paramBytes)
+          paramBytes = end;
+      }
+    }
+  }
+
+  int turned = 0;
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    std::list<Instruction*>::iterator first;
+    int numBytes;
+    LCall *call = Match(b, first, &numBytes);
+    if (!call || numBytes > paramBytes) continue;
+    for (int k = 0; k < numBytes / CodeGenerator::VarSize; k++)
+      ++first;
+    b->code.erase(first, b->code.end());
+    b->code.push_back(new TailCall(call->GetLabel(), numBytes));
+    turned++;
+  }
+  if (turned > 0) {
+    graph->Rebuild();
+    graph->RemoveUnreachableBlocks();
+  }
+  return turned;
+}
@@ -0,0 +1,57 @@
+/* File: tailcall.h
+ * ----------------
+ * Calls in tail position, the last thing a function does before it
+ * returns what the call returned:
+ *
+ *      PushParam b ;  PushParam a ;  t = LCall _f ;  PopParams 8 ;
+ *      Return t ;
+ *
+ * RemoveRecursion handles the calls a function makes to itself (a
+ * direct LCall, so global functions and devirtualized methods). The
+ * arguments are copied to new temps, then over the parameters, and a
+ * Goto jumps back to the top of the body, which turns the recursion
+ * into a loop that the optimizations after it see as one. It runs
+ * before inlining, so a function whose only self calls went away can
+ * be inlined too.
+ *
+ * ReuseFrames runs once a function is optimized and turns the other
+ * calls in tail position into a TailCall, which pops the caller's
+ * frame and jumps to the callee (see Mips::EmitTailCall). The callee
+ * takes its arguments where the caller got its own, so it may take no
+ * more than the caller is known to have been passed: the highest
+ * parameter the caller uses tells.
+ */
+
+#ifndef _H_tailcall
+#define _H_tailcall
+
+#include <list>
+#include "tac.h"
+
+class FlowGraph;
+class BasicBlock;
+
+class TailCalls
+{
+  protected:
+    FlowGraph *graph;
+
+    LCall *Match(BasicBlock *b, std::list<Instruction*>::iterator &first,
+                 int *numBytes);
+
+  public:
+    static const int MaxSteps = 16;   // instructions and blocks followed
+                                      // from a call to the Return
+
+    TailCalls(FlowGraph *graph) : graph(graph) {}
+
+         // Turns the self calls in tail position into jumps back to the
+         // entry. Returns the number of calls removed.
+    int RemoveRecursion();
+
+         // Turns the other calls in tail position that fit the caller's
+         // parameter area into TailCalls. Returns the number turned.
+    int ReuseFrames();
+};
+
+#endif
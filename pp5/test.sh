@@ -1,24 +1,34 @@
 #!/bin/bash
 
+# Every sample is run unoptimized and with the optimizer (-O)
+for opt in "" -O; do
 for a in samples/*.decaf; do
 	# Some files now read input from the user so they don't have a .out file
 	# Don't run those in automated testing
-
-	if [ -f ${a%.*}.out ]; then
+	# A name-O.out file is the expected output at -O; a sample that
+	# only has one (it needs the optimizer to run) is skipped without it
+	out=${a%.*}$opt.out
+	if [ ! -f $out ]; then out=${a%.*}.out; fi
+	# and a name.in file is given to the sample as its input
+	in=${a%.*}.in
+	if [ ! -f $in ]; then in=/dev/null; fi
+
+	if [ -f $out ]; then
 		rm /tmp/`basename ${a%.*}.asm`;
 
 		touch /tmp/`basename ${a%.*}.txt`;
 
-		echo ${a%.*};
+		echo ${a%.*} $opt;
 
 		#cat ${a%.*}.decaf | ./dcc > /tmp/`basename ${a%.*}.txt` 2>&1;
-		./dcc < ${a%.*}.decaf > /tmp/`basename ${a%.*}.asm`
+		./dcc $opt < ${a%.*}.decaf > /tmp/`basename ${a%.*}.asm`
 
                 cat defs.asm >> /tmp/`basename ${a%.*}.asm`
 
-                spim -file "/tmp/`basename ${a%.*}.asm`" | tail -n +5 > /tmp/`basename ${a%.*}.txt`
+                spim -file "/tmp/`basename ${a%.*}.asm`" < $in | tail -n +5 > /tmp/`basename ${a%.*}.txt`
 
-		diff -y -w ${a%.*}.out /tmp/`basename ${a%.*}.txt`;
+		diff -y -w $out /tmp/`basename ${a%.*}.txt`;
 		echo
 	fi
 done
+done
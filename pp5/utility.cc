@@ -11,6 +11,7 @@
 
 static List<const char*> debugKeys;
 static const int BufferSize = 2048;
+static int optimizationLevel = 0;
 
 void Failure(const char *format, ...)
 {
@@ -66,17 +67,31 @@ void PrintDebug(const char *key, const char *format, ...)
 }
 
 
+int GetOptimizationLevel()
+{
+  return optimizationLevel;
+}
+
+void SetOptimizationLevel(int level)
+{
+  optimizationLevel = level;
+}
+
+
 void ParseCommandLine(int argc, char *argv[])
 {
-  if (argc == 1)
+  int i = 1;
+  for (; i < argc && !strncmp(argv[i], "-O", 2); i++)
+    SetOptimizationLevel(argv[i][2] ? atoi(argv[i] + 2) : 1);
+
+  if (i == argc)
     return;
   
-  if (strcmp(argv[1], "-d") != 0) { // first arg is not -d
-    printf("Usage:   -d <debug-key-1> <debug-key-2> ... \n");
+  if (strcmp(argv[i], "-d") != 0) { // remaining args don't start with -d
+    printf("Usage:   [-O<level>] -d <debug-key-1> <debug-key-2> ... \n");
     exit(2);
   }
 
-  for (int i = 2; i < argc; i++)
+  for (i++; i < argc; i++)
     SetDebugForKey(argv[i], true);
 }
-
@@ -72,11 +72,22 @@ bool IsDebugOn(const char *key);
 
 
 
+/* Function: GetOptimizationLevel()
+ * Usage: if (GetOptimizationLevel() > 0) ...
+ * ------------------------------------------
+ * Returns the optimization level requested on the command line with
+ * -O<level> (-O alone means 1). Level 0, the default, does no
+ * optimization.
+ */
+int GetOptimizationLevel();
+void SetOptimizationLevel(int level);
+
+
 /* Function: ParseCommandLine
  * --------------------------
- * Turn on the debugging flags from the command line.  Verifies that
- * first argument is -d, and then interpret all the arguments that follow
- * as being flags to turn on.
+ * Turn on the debugging flags from the command line.  An optional
+ * -O<level> selects the optimization level, then if -d is given all
+ * the arguments that follow are interpreted as flags to turn on.
  */
 void ParseCommandLine(int argc, char *argv[]);
      
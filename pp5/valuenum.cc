@@ -0,0 +1,250 @@
+/* File: valuenum.cc
+ * -----------------
+ * Implementation of value numbering.
+ */
+
+#include "valuenum.h"
+#include "cfg.h"
+#include <set>
+
+
+LocalValueNumbering::LocalValueNumbering(FlowGraph *g)
+{
+  graph = g;
+  nextNumber = 0;
+  memory = nextNumber++;
+}
+
+// Globals can change behind our back, so each read is a new value.
+int LocalValueNumbering::ValueNumber(Location *loc)
+{
+  if (loc->GetSegment() == gpRelative) return nextNumber++;
+  std::map<Location*, int>::iterator p = numbers.find(loc);
+  if (p != numbers.end()) return p->second;
+  return numbers[loc] = nextNumber++;
+}
+
+bool LocalValueNumbering::IsConstant(Location *loc, int *value)
+{
+  std::map<int, int>::iterator p = constants.find(ValueNumber(loc));
+  if (p == constants.end()) return false;
+  *value = p->second;
+  return true;
+}
+
+Location *LocalValueNumbering::Resolve(Location *loc)
+{
+  std::map<Location*, Location*>::iterator p;
+  while ((p = replace.find(loc)) != replace.end())
+    loc = p->second;
+  return loc;
+}
+
+/* Method: Lookup
+ * --------------
+ * If e is already available, dst is renamed to the location holding it
+ * and true is returned. Otherwise dst becomes the holder of a new value.
+ */
+bool LocalValueNumbering::Lookup(Expr e, Location *dst)
+{
+  std::map<Expr, Location*>::iterator p = table.find(e);
+  if (p != table.end()) {
+    replace[dst] = p->second;
+    numbers[dst] = ValueNumber(p->second);
+    return true;
+  }
+  table[e] = dst;
+  int n = ValueNumber(dst);
+  if (e.kind == ConstKind) constants[n] = e.a;
+  return false;
+}
+
+
+/* Method: NumberPhi
+ * -----------------
+ * A phi whose arguments are all the same location (or the phi itself,
+ * around a loop that doesn't change it) is just a copy of it. The
+ * location's definition dominates every predecessor, so it dominates
+ * the phi's block as well. Returns true if the phi is redundant.
+ */
+bool LocalValueNumbering::NumberPhi(Phi *phi)
+{
+  Location *dst = phi->GetDef(), *same = NULL;
+  for (int i = 0; i < phi->NumArgs(); i++) {
+    Location *arg = phi->GetArg(i) ? Resolve(phi->GetArg(i)) : NULL;
+    if (arg == dst) continue;
+    if (arg == NULL || (same && arg != same)) return false;
+    same = arg;
+  }
+  if (same == NULL) return false;
+  replace[dst] = same;
+  numbers[dst] = ValueNumber(same);
+  return true;
+}
+
+
+int LocalValueNumbering::NumberBlock(BasicBlock *b)
+{
+  int removed = 0;
+
+  std::list<Instruction*>::iterator p = b->code.begin();
+  while (p != b->code.end()) {
+    Instruction *instr = *p;
+    Location *dst = instr->GetDef();
+    bool redundant = false;
+
+    BinaryOp *op = dynamic_cast<BinaryOp*>(instr);
+    int a, c;
+    if (op && dst->GetSegment() == fpRelative) {
+      BinaryOp::OpCode code = op->GetCode();
+      int va = ValueNumber(op->GetOp1()), vb = ValueNumber(op->GetOp2());
+      bool aConst = IsConstant(op->GetOp1(), &a), bConst = IsConstant(op->GetOp2(), &c);
+      int result;
+      if (aConst && bConst && BinaryOp::Evaluate(code, a, c, &result)) {
+        instr = *p = new LoadConstant(dst, result);
+      } else if ((bConst && c == 0 && (code == BinaryOp::Add || code == BinaryOp::Sub))
+                 || (bConst && c == 1 && code == BinaryOp::Mul)) {
+        instr = *p = new Assign(dst, op->GetOp1());
+      } else if ((aConst && a == 0 && code == BinaryOp::Add)
+                 || (aConst && a == 1 && code == BinaryOp::Mul)) {
+        instr = *p = new Assign(dst, op->GetOp2());
+      } else {
+        if (BinaryOp::IsCommutative(code) && vb < va) std::swap(va, vb);
+        redundant = Lookup(Expr(code, va, vb), dst);
+      }
+    }
+
+    if (dynamic_cast<Phi*>(instr)) {
+      redundant = NumberPhi(dynamic_cast<Phi*>(instr));
+    } else if (dynamic_cast<LoadConstant*>(instr) && dst->GetSegment() == fpRelative) {
+      redundant = Lookup(Expr(ConstKind, dynamic_cast<LoadConstant*>(instr)->GetValue(), 0), dst);
+    } else if (dynamic_cast<LoadLabel*>(instr) && dst->GetSegment() == fpRelative) {
+      std::string label = dynamic_cast<LoadLabel*>(instr)->GetLabel();
+      if (!labels.count(label)) {
+        int n = labels.size();
+        labels[label] = n;
+      }
+      redundant = Lookup(Expr(LabelKind, labels[label], 0), dst);
+    } else if (dynamic_cast<Load*>(instr) && dst->GetSegment() == fpRelative) {
+      Load *load = dynamic_cast<Load*>(instr);
+      int version = load->IsInvariant() ? 0 : memory;
+      redundant = Lookup(Expr(LoadKind, ValueNumber(load->GetSrc()), load->GetOffset(), version), dst);
+    } else if (dynamic_cast<Store*>(instr)) {
+      Store *store = dynamic_cast<Store*>(instr);
+      memory = nextNumber++;
+      if (store->GetSrc()->GetSegment() == fpRelative)
+        table[Expr(LoadKind, ValueNumber(store->GetDst()), store->GetOffset(), memory)] = store->GetSrc();
+    } else if (dynamic_cast<Assign*>(instr)) {
+      Location *src = dynamic_cast<Assign*>(instr)->GetSrc();
+      if (dst->GetSegment() == fpRelative && src->GetSegment() == fpRelative)
+        numbers[dst] = ValueNumber(src);
+    } else if (instr->IsCall()) {
+      memory = nextNumber++;
+    }
+
+    if (redundant) {
+      p = b->code.erase(p);
+      removed++;
+    } else {
+      ++p;
+    }
+  }
+  return removed;
+}
+
+
+void LocalValueNumbering::RenameUses()
+{
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    BasicBlock *b = graph->Nth(i);
+    std::list<Instruction*>::iterator p;
+    for (p = b->code.begin(); p != b->code.end(); ++p) {
+      List<Location*> uses;
+      (*p)->GetUses(&uses);
+      for (int j = 0; j < uses.NumElements(); j++)
+        if (replace.count(uses.Nth(j)))
+          (*p)->ReplaceUse(uses.Nth(j), Resolve(uses.Nth(j)));
+    }
+  }
+}
+
+
+int LocalValueNumbering::Run()
+{
+  int removed = 0;
+  for (int i = 0; i < graph->NumBlocks(); i++) {
+    numbers.clear();
+    constants.clear();
+    table.clear();
+    memory = nextNumber++;
+    removed += NumberBlock(graph->Nth(i));
+  }
+  RenameUses();
+  return removed;
+}
+
+
+bool GlobalValueNumbering::WritesMemory(BasicBlock *b)
+{
+  std::list<Instruction*>::iterator p;
+  for (p = b->code.begin(); p != b->code.end(); ++p)
+    if (dynamic_cast<Store*>(*p) || (*p)->IsCall())
+      return true;
+  return false;
+}
+
+/* Method: MemoryChangesBetween
+ * ----------------------------
+ * Returns true if some path from dom (which dominates b) to the start
+ * of b passes through a block that writes memory. Walks backwards from
+ * b without going past dom; every block reached lies on such a path.
+ */
+bool GlobalValueNumbering::MemoryChangesBetween(BasicBlock *dom, BasicBlock *b)
+{
+  std::set<BasicBlock*> seen;
+  List<BasicBlock*> work;
+  work.Append(b);
+  while (work.NumElements() > 0) {
+    BasicBlock *cur = work.Nth(work.NumElements() - 1);
+    work.RemoveAt(work.NumElements() - 1);
+    for (int i = 0; i < cur->preds->NumElements(); i++) {
+      BasicBlock *pred = cur->preds->Nth(i);
+      if (pred == dom || seen.count(pred)) continue;
+      if (WritesMemory(pred)) return true;
+      seen.insert(pred);
+      work.Append(pred);
+    }
+  }
+  return false;
+}
+
+/* Method: NumberTree
+ * ------------------
+ * Numbers b and then the blocks it dominates. The expressions found in
+ * b are only available in its subtree, so the table is put back the
+ * way it was before returning. Value numbers of SSA names are the same
+ * everywhere and are kept.
+ */
+int GlobalValueNumbering::NumberTree(BasicBlock *b)
+{
+  if (b->idom && !MemoryChangesBetween(b->idom, b))
+    memory = exitMemory[b->idom];
+  else
+    memory = nextNumber++;
+
+  std::map<Expr, Location*> saved = table;
+  int removed = NumberBlock(b);
+  exitMemory[b] = memory;
+  for (int i = 0; i < b->domChildren->NumElements(); i++)
+    removed += NumberTree(b->domChildren->Nth(i));
+  table.swap(saved);
+  return removed;
+}
+
+
+int GlobalValueNumbering::Run()
+{
+  int removed = NumberTree(graph->GetEntry());
+  RenameUses();
+  return removed;
+}
@@ -0,0 +1,100 @@
+/* File: valuenum.h
+ * ----------------
+ * Value numbering over a function in SSA form. Two computations get
+ * the same value number when they apply the same operator to operands
+ * with the same value numbers; the second one is then redundant and
+ * its result can be taken from the first.
+ *
+ * The LocalValueNumbering class does this within each basic block for
+ * BinaryOp, LoadConstant, LoadLabel and Load, and folds operations on
+ * constants (BinaryOp::Evaluate). The heap is given a version number
+ * that every Store and call replaces, since either may change it, and
+ * a Load is only redundant with a Load of the same address under the
+ * same version. A Store itself makes its value available to a later
+ * Load of the same address. Invariant loads (Load::IsInvariant) ignore
+ * the version. Globals are not in SSA form, so instructions reading or
+ * writing them are left alone.
+ *
+ * GlobalValueNumbering extends this to the whole function by walking
+ * the dominator tree: whatever is available at the end of a block is
+ * available in the blocks it dominates. A dominated block keeps the
+ * heap version of its dominator only if no path between the two passes
+ * a Store or call.
+ *
+ * Both also remove phis whose arguments (other than the phi's own
+ * result) are all the same location, as they are only copies of it.
+ *
+ * A redundant instruction is deleted and the uses of its result are
+ * renamed to the earlier result, which in SSA form is never redefined
+ * and dominates all those uses.
+ */
+
+#ifndef _H_valuenum
+#define _H_valuenum
+
+#include <map>
+#include <string>
+#include "tac.h"
+
+class FlowGraph;
+class BasicBlock;
+
+class LocalValueNumbering
+{
+  protected:
+    struct Expr {
+      int kind, a, b, memory;
+      Expr(int k, int x, int y, int m = 0) : kind(k), a(x), b(y), memory(m) {}
+      bool operator<(const Expr &e) const {
+        if (kind != e.kind) return kind < e.kind;
+        if (a != e.a) return a < e.a;
+        return b != e.b ? b < e.b : memory < e.memory;
+      }
+    };
+    enum { ConstKind = -1, LabelKind = -2, LoadKind = -3 };  // or a BinaryOp::OpCode
+
+    FlowGraph *graph;
+    std::map<Location*, Location*> replace;
+    std::map<std::string, int> labels;
+    std::map<Location*, int> numbers;
+    std::map<int, int> constants;     // value number -> constant value
+    std::map<Expr, Location*> table;  // expression -> location holding it
+    int nextNumber;
+    int memory;                       // current version of the heap
+
+    int ValueNumber(Location *loc);
+    bool IsConstant(Location *loc, int *value);
+    Location *Resolve(Location *loc);
+    bool Lookup(Expr e, Location *dst);
+    bool NumberPhi(Phi *phi);
+    int NumberBlock(BasicBlock *b);
+    void RenameUses();
+
+  public:
+    LocalValueNumbering(FlowGraph *graph);
+    virtual ~LocalValueNumbering() {}
+
+         // Returns the number of instructions removed
+    virtual int Run();
+};
+
+class GlobalValueNumbering : public LocalValueNumbering
+{
+  protected:
+    std::map<BasicBlock*, int> exitMemory;  // heap version at end of block
+
+    static bool WritesMemory(BasicBlock *b);
+    bool MemoryChangesBetween(BasicBlock *dom, BasicBlock *b);
+    int NumberTree(BasicBlock *b);
+
+  public:
+         // Functions with more blocks than this are numbered locally,
+         // copying the table down the dominator tree gets too costly
+    static const int MaxBlocks = 1000;
+
+    GlobalValueNumbering(FlowGraph *graph) : LocalValueNumbering(graph) {}
+
+    int Run();
+};
+
+#endif